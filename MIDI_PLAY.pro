@@ -8,7 +8,31 @@ TEMPLATE = app
 SOURCES += midi_play.cpp \
     main.cpp \
     player.cpp \
-    file_parser.cpp
-HEADERS += midi_play.h
+    output.cpp \
+    file_parser.cpp \
+    song_loader.cpp \
+    mixer.cpp
+HEADERS += midi_play.h \
+    event_store.h \
+    smf_decoder.h \
+    song_cache.h \
+    song_loader.h \
+    player.h \
+    chase.h \
+    tempo_map.h \
+    meters.h \
+    output.h \
+    mixer.h
 FORMS += midi_play.ui
+# the decoder is built as its own library, see libsmf.pro
+libsmf.target = libsmf.a
+libsmf.commands = $(QMAKE) -o Makefile.smf libsmf.pro && $(MAKE) -f Makefile.smf
+libsmf.depends = smf_decoder.cpp smf_decoder.h song_cache.cpp song_cache.h chase.cpp chase.h tempo_map.cpp tempo_map.h meters.cpp meters.h event_store.h
+# decoder benchmark, "make bench", see smf_bench.pro
+bench.target = bench
+bench.commands = $(QMAKE) -o Makefile.bench smf_bench.pro && $(MAKE) -f Makefile.bench
+bench.depends = libsmf.a smf_bench.cpp
+QMAKE_EXTRA_TARGETS += libsmf bench
+PRE_TARGETDEPS += libsmf.a
+LIBS += -L. -lsmf
 DEFINES += QT_NO_DEBUG_OUTPUT
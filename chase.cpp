@@ -0,0 +1,237 @@
+// chase.cpp -- part of MIDI_PLAY, built into libsmf.a
+// controller chase snapshots, see chase.h. No Qt, no ALSA calls: the
+// state is read from an EVENT_STORE and put back as events in another one.
+// contains:
+//      build()     -- one pass over the song, a snapshot every CHASE_INTERVAL events
+//      state_at()  -- nearest snapshot at or before an event, plus the events in between
+//      restore()   -- the state as a burst of events at one tick
+//      start()     -- the state before the first event
+//      apply()     -- update a state with one event
+//      is_reset()  -- sysex is a GM, GS or XG system reset
+
+#include "chase.h"
+
+// what data entry (CC 6/38) goes to: the last parameter selected
+enum { SELECT_NONE, SELECT_RPN, SELECT_NRPN };
+
+void CHASE_TABLE::build(const EVENT_STORE &events, int song_tempo) {
+    struct chase_state state;
+    initial_tempo = song_tempo;
+    memset(channels_used, 0, sizeof(channels_used));
+    // most songs use one port, and their snapshots hold just that one
+    ports = 1;
+    for (unsigned int i = 0; i < events.size(); ++i)
+        if (events.port(i) % SONG_PORTS >= ports)
+            ports = events.port(i) % SONG_PORTS + 1;
+    start(state);
+    std::vector<struct chase_state>().swap(snapshots);
+    snapshots.reserve(events.size() / CHASE_INTERVAL + 1);
+    for (unsigned int i = 0; i < events.size(); ++i) {
+        if (i % CHASE_INTERVAL == 0)
+            snapshots.push_back(state);
+        switch (events.type(i)) {
+        case SND_SEQ_EVENT_CONTROLLER:
+        case SND_SEQ_EVENT_PGMCHANGE:
+        case SND_SEQ_EVENT_CHANPRESS:
+        case SND_SEQ_EVENT_PITCHBEND:
+            channels_used[events.port(i) % SONG_PORTS] |= 1 << (events.channel(i) & 0x0f);
+            break;
+        default:
+            break;
+        }
+        apply(events, i, state);
+    }
+}   // end build
+
+void CHASE_TABLE::state_at(const EVENT_STORE &events, unsigned int event, struct chase_state &state) const {
+    // the state in force for event, from everything before it
+    unsigned int from = 0;
+    if (snapshots.empty())
+        start(state);
+    else {
+        unsigned int k = event / CHASE_INTERVAL;
+        if (k >= snapshots.size())
+            k = snapshots.size() - 1;
+        state = snapshots[k];
+        from = k * CHASE_INTERVAL;
+    }
+    for (unsigned int i = from; i < event && i < events.size(); ++i)
+        apply(events, i, state);
+}   // end state_at
+
+void CHASE_TABLE::restore(const EVENT_STORE &events, unsigned int event, unsigned int tick, EVENT_STORE &burst) const {
+    // burst becomes the events, all at tick, that bring a device from any
+    // state to the one in force for event: the last reset of each port,
+    // the tempo, then for each channel the song sets up, reset all
+    // controllers followed by whatever has been set since. Events go to
+    // the song port they were set on
+    struct chase_state state;
+    state_at(events, event, state);
+    burst.clear();
+    for (unsigned char p = 0; p < state.port.size(); ++p) {
+        int reset = state.port[p].reset;
+        if (reset >= 0)
+            burst.push_sysex(tick, p, 0, 0, events.sysex_data(reset), events.sysex_length(reset));
+    }
+    burst.push_tempo(tick, 0, state.tempo);
+    for (unsigned int k = 0; k < state.port.size() * 16; ++k) {
+        unsigned char p = k / 16, c = k % 16;
+        if (!(channels_used[p] & (1 << c)))
+            continue;
+        const struct chase_channel &ch = state.port[p].ch[c];
+        burst.push_channel(tick, SND_SEQ_EVENT_CONTROLLER, p, c, 121, 0);
+        // bank select goes ahead of the program change it applies to
+        if (ch.cc[0] != CHASE_UNSET)
+            burst.push_channel(tick, SND_SEQ_EVENT_CONTROLLER, p, c, 0, ch.cc[0]);
+        if (ch.cc[32] != CHASE_UNSET)
+            burst.push_channel(tick, SND_SEQ_EVENT_CONTROLLER, p, c, 32, ch.cc[32]);
+        if (ch.program != CHASE_UNSET)
+            burst.push_channel(tick, SND_SEQ_EVENT_PGMCHANGE, p, c, ch.program);
+        for (unsigned char n = 1; n < 120; ++n) {
+            if (ch.cc[n] == CHASE_UNSET || n == 6 || n == 32 || n == 38 || (n >= 96 && n <= 101))
+                continue;
+            burst.push_channel(tick, SND_SEQ_EVENT_CONTROLLER, p, c, n, ch.cc[n]);
+        }
+        bool selected = false;
+        for (unsigned char r = 0; r < CHASE_RPNS; ++r) {
+            if (ch.rpn[r][0] == CHASE_UNSET && ch.rpn[r][1] == CHASE_UNSET)
+                continue;
+            burst.push_channel(tick, SND_SEQ_EVENT_CONTROLLER, p, c, 101, 0);
+            burst.push_channel(tick, SND_SEQ_EVENT_CONTROLLER, p, c, 100, r);
+            if (ch.rpn[r][0] != CHASE_UNSET)
+                burst.push_channel(tick, SND_SEQ_EVENT_CONTROLLER, p, c, 6, ch.rpn[r][0]);
+            if (ch.rpn[r][1] != CHASE_UNSET)
+                burst.push_channel(tick, SND_SEQ_EVENT_CONTROLLER, p, c, 38, ch.rpn[r][1]);
+            selected = true;
+        }
+        if (ch.nrpn[0] != CHASE_UNSET && ch.nrpn[1] != CHASE_UNSET &&
+            (ch.nrpn[2] != CHASE_UNSET || ch.nrpn[3] != CHASE_UNSET)) {
+            burst.push_channel(tick, SND_SEQ_EVENT_CONTROLLER, p, c, 99, ch.nrpn[0]);
+            burst.push_channel(tick, SND_SEQ_EVENT_CONTROLLER, p, c, 98, ch.nrpn[1]);
+            if (ch.nrpn[2] != CHASE_UNSET)
+                burst.push_channel(tick, SND_SEQ_EVENT_CONTROLLER, p, c, 6, ch.nrpn[2]);
+            if (ch.nrpn[3] != CHASE_UNSET)
+                burst.push_channel(tick, SND_SEQ_EVENT_CONTROLLER, p, c, 38, ch.nrpn[3]);
+            selected = true;
+        }
+        // leave the parameter selection as the song had it, so its next
+        // data entry goes where it was meant to
+        int msb = ch.select == SELECT_NRPN ? 99 : 101;
+        if (ch.select != SELECT_NONE && ch.cc[msb] != CHASE_UNSET && ch.cc[msb - 1] != CHASE_UNSET) {
+            burst.push_channel(tick, SND_SEQ_EVENT_CONTROLLER, p, c, msb, ch.cc[msb]);
+            burst.push_channel(tick, SND_SEQ_EVENT_CONTROLLER, p, c, msb - 1, ch.cc[msb - 1]);
+        } else if (selected) {
+            burst.push_channel(tick, SND_SEQ_EVENT_CONTROLLER, p, c, 101, 127);
+            burst.push_channel(tick, SND_SEQ_EVENT_CONTROLLER, p, c, 100, 127);
+        }
+        if (ch.bend[1] != CHASE_UNSET)
+            burst.push_channel(tick, SND_SEQ_EVENT_PITCHBEND, p, c, ch.bend[0], ch.bend[1]);
+        if (ch.pressure != CHASE_UNSET)
+            burst.push_channel(tick, SND_SEQ_EVENT_CHANPRESS, p, c, ch.pressure);
+    }
+}   // end restore
+
+void CHASE_TABLE::start(struct chase_state &state) const {
+    struct chase_port clean;
+    clean.clear();
+    state.tempo = initial_tempo;
+    state.port.assign(ports, clean);
+}   // end start
+
+void CHASE_TABLE::apply(const EVENT_STORE &events, unsigned int i, struct chase_state &state) {
+    if (events.type(i) == SND_SEQ_EVENT_TEMPO) {
+        state.tempo = events.tempo(i);
+        return;
+    }
+    unsigned int p = events.port(i) % SONG_PORTS;
+    if (p >= state.port.size())
+        return;
+    struct chase_channel &ch = state.port[p].ch[events.channel(i) & 0x0f];
+    unsigned char n = events.data1(i), value = events.data2(i);
+    switch (events.type(i)) {
+    case SND_SEQ_EVENT_SYSEX:
+        // a reset puts every channel of its port back to its defaults
+        if (is_reset(events.sysex_data(i), events.sysex_length(i))) {
+            state.port[p].clear();
+            state.port[p].reset = i;
+        }
+        break;
+    case SND_SEQ_EVENT_PGMCHANGE:
+        ch.program = n;
+        break;
+    case SND_SEQ_EVENT_CHANPRESS:
+        ch.pressure = n;
+        break;
+    case SND_SEQ_EVENT_PITCHBEND:
+        ch.bend[0] = n;
+        ch.bend[1] = value;
+        break;
+    case SND_SEQ_EVENT_CONTROLLER:
+        switch (n) {
+        case 6:
+        case 38:
+            // data entry msb/lsb, for the parameter selected last
+            if (ch.select == SELECT_RPN) {
+                if (ch.cc[101] == 0 && ch.cc[100] < CHASE_RPNS)
+                    ch.rpn[ch.cc[100]][n == 38] = value;
+            } else if (ch.select == SELECT_NRPN) {
+                if (ch.nrpn[0] != ch.cc[99] || ch.nrpn[1] != ch.cc[98]) {
+                    ch.nrpn[0] = ch.cc[99];
+                    ch.nrpn[1] = ch.cc[98];
+                    ch.nrpn[2] = ch.nrpn[3] = CHASE_UNSET;
+                }
+                ch.nrpn[2 + (n == 38)] = value;
+            }
+            break;
+        case 96:
+        case 97:
+            // data increment/decrement aren't chased
+            break;
+        case 98:
+        case 99:
+            ch.cc[n] = value;
+            ch.select = SELECT_NRPN;
+            break;
+        case 100:
+        case 101:
+            ch.cc[n] = value;
+            ch.select = SELECT_RPN;
+            break;
+        case 121:
+            // reset all controllers: all but bank, volume, pan and the
+            // effect sends go back to their defaults, no parameter selected
+            for (int c = 1; c < 120; ++c)
+                if (c != 7 && c != 10 && c != 32 && c != 91 && c != 93)
+                    ch.cc[c] = CHASE_UNSET;
+            ch.bend[1] = CHASE_UNSET;
+            ch.pressure = CHASE_UNSET;
+            ch.select = SELECT_NONE;
+            break;
+        default:
+            // the channel mode messages leave no state to chase
+            if (n < 120)
+                ch.cc[n] = value;
+            break;
+        }   // end SWITCH controller
+        break;
+    default:
+        // notes have nothing to chase
+        break;
+    }   // end SWITCH type
+}   // end apply
+
+bool CHASE_TABLE::is_reset(const unsigned char *data, unsigned int length) {
+    // payloads are kept with their leading F0
+    static const unsigned char gs_reset[] = { 0x42, 0x12, 0x40, 0x00, 0x7F, 0x00 };
+    static const unsigned char xg_on[] = { 0x4C, 0x00, 0x00, 0x7E, 0x00 };
+    if (!data || length < 6 || data[0] != 0xF0)
+        return false;
+    // GM system on, off and GM2 on, any device id
+    if (data[1] == 0x7E && data[3] == 0x09 && data[4] >= 0x01 && data[4] <= 0x03)
+        return true;
+    if (data[1] == 0x41 && length >= 9 && !memcmp(data + 3, gs_reset, sizeof(gs_reset)))
+        return true;
+    if (data[1] == 0x43 && (data[2] & 0xF0) == 0x10 && length >= 8 && !memcmp(data + 3, xg_on, sizeof(xg_on)))
+        return true;
+    return false;
+}   // end is_reset
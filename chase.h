@@ -0,0 +1,92 @@
+// chase.h -- part of MIDI_PLAY, built into libsmf.a
+// controller chase for starting a song part way through: what every channel
+// has been set to by the events before a given one (program, bank, all
+// controllers, RPN/NRPN values, pitch bend, pressure), with the tempo and
+// the last GM/GS/XG reset, for each song port (0x21) the song uses, as the
+// ports may go to different devices. The state is kept as a snapshot every
+// CHASE_INTERVAL events, built once when the song is loaded, so finding it
+// for any place in the song replays less than one interval of events.
+// contains:
+//      chase_channel -- what one channel has been set to
+//      chase_port  -- the state of one port's channels and its last reset
+//      chase_state -- the state of all ports and the tempo at one event
+//      CHASE_TABLE -- the snapshots of one song
+//      build()     -- take the snapshots from a song's events
+//      state_at()  -- the state in force just before an event
+//      restore()   -- the events that set a device up to that state
+
+#ifndef CHASE_H
+#define CHASE_H
+
+#include "event_store.h"
+#include <vector>
+
+// events between snapshots
+#define CHASE_INTERVAL 4096
+// registered parameters that are chased: pitch bend range, fine and
+// coarse tuning, tuning program and bank, modulation depth range
+#define CHASE_RPNS 6
+// value of a controller, program or pressure that hasn't been set
+#define CHASE_UNSET 0xff
+
+struct chase_channel {
+    unsigned char cc[128];              // CHASE_UNSET or the value
+    unsigned char program;
+    unsigned char pressure;
+    unsigned char bend[2];              // lsb, msb as stored; msb CHASE_UNSET if unset
+    unsigned char rpn[CHASE_RPNS][2];   // data entry msb, lsb of each registered parameter
+    unsigned char nrpn[4];              // last NRPN set: number msb, lsb, data msb, lsb
+    unsigned char select;               // which of the two data entry goes to, see chase.cpp
+
+    void clear() {
+        memset(this, CHASE_UNSET, sizeof(*this));
+        select = 0;
+    }
+};
+
+struct chase_port {
+    int reset;                          // event index of the last reset sysex, -1 if none
+    struct chase_channel ch[16];
+
+    void clear() {
+        reset = -1;
+        for (int c = 0; c < 16; ++c)
+            ch[c].clear();
+    }
+};
+
+struct chase_state {
+    int tempo;                          // usec per quarter in force
+    std::vector<struct chase_port> port;    // by song port, as many as the song uses
+};
+
+class CHASE_TABLE {
+public:
+    CHASE_TABLE() : initial_tempo(500000), ports(1) {
+        memset(channels_used, 0, sizeof(channels_used));
+    }
+    void clear() {
+        snapshots.clear();
+        ports = 1;
+        memset(channels_used, 0, sizeof(channels_used));
+    }
+    bool empty() const { return snapshots.empty(); }
+    void build(const EVENT_STORE &events, int song_tempo);
+    void state_at(const EVENT_STORE &events, unsigned int event, struct chase_state &state) const;
+    void restore(const EVENT_STORE &events, unsigned int event, unsigned int tick, EVENT_STORE &burst) const;
+    unsigned long bytes() const {
+        return snapshots.capacity() * (sizeof(struct chase_state) + ports * sizeof(struct chase_port));
+    }
+
+private:
+    void start(struct chase_state &state) const;
+    static void apply(const EVENT_STORE &events, unsigned int i, struct chase_state &state);
+    static bool is_reset(const unsigned char *data, unsigned int length);
+
+    std::vector<struct chase_state> snapshots;  // state before event n * CHASE_INTERVAL
+    int initial_tempo;
+    unsigned int ports;                 // song ports in each state, 1 + the highest used
+    unsigned int channels_used[SONG_PORTS]; // by port, bit n set if channel n is set anywhere in the song
+};  // end class CHASE_TABLE
+
+#endif // CHASE_H
@@ -0,0 +1,362 @@
+// event_store.h -- part of MIDI_PLAY
+// compact memory image of the events of one song, kept as parallel arrays
+// (structure of arrays) instead of a vector of event structs.
+// A channel event costs 10 bytes: tick(4) type(1) port(1) data(4).
+// The data word holds
+//      channel events: channel | data1 << 8 | data2 << 16
+//      tempo events:   tempo in usec per quarter note
+//      sysex events:   index of the payload's offset/length in the sysex table
+// All sysex payloads of the song live back to back in one arena, so loading
+// a sysex-heavy setup file does not make an allocation per message.
+// The accessors read through pointers, to the arrays or, for a song taken
+// from the song cache, straight into the mapped cache file; the store owns
+// that mapping and lets it go on clear(), or copies it out if written to.
+// contains:
+//      EVENT_STORE -- the store
+//      push_channel(), push_tempo(), push_sysex() -- append an event
+//      append()    -- copy one event over from another store
+//      tick(), type(), port(), channel(), data1(), data2(), tempo() -- accessors
+//      sysex_data(), sysex_length() -- sysex payload of an event
+//      reserve_sysex() -- size the sysex table and arena up front
+//      allocate()  -- size the store exactly, to be filled in place through spans
+//      span        -- writes one part of an allocated store, same push calls as the store
+//      gather()    -- take another store's events in a given order, one array at a time
+//      index_ticks() -- build the coarse tick index of a complete store
+//      find()      -- first event at or after a tick, by binary search
+//      bytes()     -- memory used by the store
+//      event_count -- counts what the push calls would store, for sizing a store
+//      tempo_chg   -- one entry of a song's tempo table
+
+#ifndef EVENT_STORE_H
+#define EVENT_STORE_H
+
+#include <alsa/asoundlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <vector>
+#include <algorithm>
+
+// song ports (meta event 0x21) told apart, port() is always below this
+#define SONG_PORTS 16
+
+struct tempo_chg {
+  unsigned int tick;
+  int new_tempo;            // beats per minute
+};
+
+class EVENT_STORE {
+    friend class SONG_CACHE;
+    struct sysex_ref;
+    friend class span;
+
+public:
+    EVENT_STORE() : bucket(1), map(0), map_bytes(0) {
+        point();
+    }
+    EVENT_STORE(const EVENT_STORE &other) : bucket(1), map(0), map_bytes(0) {
+        copy(other);
+    }
+    EVENT_STORE &operator=(const EVENT_STORE &other) {
+        if (this != &other) {
+            unmap();
+            copy(other);
+        }
+        return *this;
+    }
+    ~EVENT_STORE() {
+        unmap();
+    }
+
+    // writer for the part of an allocated store starting at the given event,
+    // sysex and arena positions; parts don't overlap, so several spans can
+    // be filled from different threads
+    class span {
+    public:
+        span(EVENT_STORE &store, unsigned int first, unsigned int sysex_first, unsigned long arena_first) :
+            sysex_next(sysex_first), arena_next(arena_first), n(0) {
+            bool none = store.ticks.empty();
+            ticks = none ? 0 : &store.ticks[first];
+            types = none ? 0 : &store.types[first];
+            ports = none ? 0 : &store.ports[first];
+            data = none ? 0 : &store.data[first];
+            sysex = store.sysex.empty() ? 0 : &store.sysex[0];
+            arena_base = store.arena.empty() ? 0 : &store.arena[0];
+        }
+        unsigned int size() const { return n; }
+        void push_channel(unsigned int tick, unsigned char type, unsigned char port,
+                          unsigned char channel, unsigned char d1, unsigned char d2 = 0) {
+            push(tick, type, port, channel | (d1 << 8) | (d2 << 16));
+        }
+        void push_tempo(unsigned int tick, unsigned char port, int tempo) {
+            push(tick, SND_SEQ_EVENT_TEMPO, port, tempo);
+        }
+        void push_sysex(unsigned int tick, unsigned char port, const unsigned char *head,
+                        unsigned int head_len, const unsigned char *body, unsigned int body_len) {
+            push(tick, SND_SEQ_EVENT_SYSEX, port, sysex_next);
+            sysex[sysex_next].offset = arena_next;
+            sysex[sysex_next].length = head_len + body_len;
+            ++sysex_next;
+            memcpy(arena_base + arena_next, head, head_len);
+            memcpy(arena_base + arena_next + head_len, body, body_len);
+            arena_next += head_len + body_len;
+        }
+    private:
+        void push(unsigned int tick, unsigned char type, unsigned char port, unsigned int word) {
+            ticks[n] = tick;
+            types[n] = type;
+            ports[n] = port;
+            data[n] = word;
+            ++n;
+        }
+        unsigned int *ticks;
+        unsigned char *types;
+        unsigned char *ports;
+        unsigned int *data;
+        struct sysex_ref *sysex;
+        unsigned char *arena_base;
+        unsigned int sysex_next;
+        unsigned long arena_next;
+        unsigned int n;
+    };  // end class span
+
+    void clear() {
+        unmap();
+        ticks.clear();
+        types.clear();
+        ports.clear();
+        data.clear();
+        sysex.clear();
+        arena.clear();
+        first_in.clear();
+        point();
+    }
+    void reserve(unsigned int n) {
+        own();
+        ticks.reserve(n);
+        types.reserve(n);
+        ports.reserve(n);
+        data.reserve(n);
+        point();
+    }
+    void reserve_sysex(unsigned int n, unsigned long payload_bytes) {
+        own();
+        sysex.reserve(n);
+        arena.reserve(payload_bytes);
+        point();
+    }
+    void allocate(unsigned int n, unsigned int sysex_n, unsigned long payload_bytes) {
+        clear();
+        ticks.resize(n);
+        types.resize(n);
+        ports.resize(n);
+        data.resize(n);
+        sysex.resize(sysex_n);
+        arena.resize(payload_bytes);
+        point();
+    }
+    unsigned int size() const { return rd.n; }
+    bool empty() const { return !rd.n; }
+    unsigned int last_tick() const { return rd.n ? rd.ticks[rd.n - 1] : 0; }
+    unsigned int sysex_count() const { return rd.sysex_n; }
+    unsigned long sysex_bytes() const { return rd.arena_n; }
+
+    void push_channel(unsigned int tick, unsigned char type, unsigned char port,
+                      unsigned char channel, unsigned char d1, unsigned char d2 = 0) {
+        push(tick, type, port, channel | (d1 << 8) | (d2 << 16));
+    }
+    void push_tempo(unsigned int tick, unsigned char port, int tempo) {
+        push(tick, SND_SEQ_EVENT_TEMPO, port, tempo);
+    }
+    void push_sysex(unsigned int tick, unsigned char port, const unsigned char *head,
+                    unsigned int head_len, const unsigned char *body, unsigned int body_len) {
+        // payload is head followed by body, so a leading F0 needs no copy of its own
+        push(tick, SND_SEQ_EVENT_SYSEX, port, sysex.size());
+        struct sysex_ref ref;
+        ref.offset = arena.size();
+        ref.length = head_len + body_len;
+        sysex.push_back(ref);
+        arena.insert(arena.end(), head, head + head_len);
+        arena.insert(arena.end(), body, body + body_len);
+        point();
+    }
+    void append(const EVENT_STORE &src, unsigned int i) {
+        if (src.type(i) == SND_SEQ_EVENT_SYSEX)
+            push_sysex(src.tick(i), src.port(i), 0, 0, src.sysex_data(i), src.sysex_length(i));
+        else
+            push(src.tick(i), src.type(i), src.port(i), src.rd.data[i]);
+    }
+
+    void gather(EVENT_STORE &src, const std::vector<unsigned int> &order) {
+        // this becomes src's events in the given order, and src is emptied;
+        // each of src's arrays is freed as soon as it has been copied, so
+        // only one array at a time is held twice. Sysex data words index the
+        // sysex table, which isn't reordered, so it and the arena move over whole
+        unmap();
+        src.own();
+        gather_array(ticks, src.ticks, order);
+        gather_array(types, src.types, order);
+        gather_array(ports, src.ports, order);
+        gather_array(data, src.data, order);
+        sysex.swap(src.sysex);
+        arena.swap(src.arena);
+        first_in.clear();
+        point();
+        src.clear();
+    }
+
+    void index_ticks(unsigned int bucket_ticks) {
+        // coarse index, one entry per bucket_ticks (a bar, say): the first
+        // event at or after the start of each bucket, and a last entry of
+        // size(). Build it once the store is complete, pushing more events
+        // leaves it stale; clear() and gather() drop it
+        first_in.clear();
+        bucket = bucket_ticks ? bucket_ticks : 1;
+        unsigned int n = last_tick() / bucket + 1;
+        first_in.reserve(n + 1);
+        unsigned int i = 0;
+        for (unsigned int b = 0; b < n; ++b) {
+            while (i < rd.n && rd.ticks[i] < b * bucket)
+                ++i;
+            first_in.push_back(i);
+        }
+        first_in.push_back(rd.n);
+    }
+    unsigned int find(unsigned int tick) const {
+        // index of the first event at or after tick, size() if there is none;
+        // the index narrows the search to one bucket
+        const unsigned int *lo = rd.ticks, *hi = rd.ticks + rd.n;
+        if (!first_in.empty()) {
+            unsigned int b = tick / bucket;
+            if (b + 1 >= first_in.size())
+                return rd.n;
+            lo = rd.ticks + first_in[b];
+            hi = rd.ticks + first_in[b + 1];
+        }
+        return std::lower_bound(lo, hi, tick) - rd.ticks;
+    }
+
+    unsigned int tick(unsigned int i) const { return rd.ticks[i]; }
+    unsigned char type(unsigned int i) const { return rd.types[i]; }
+    unsigned char port(unsigned int i) const { return rd.ports[i]; }
+    unsigned char channel(unsigned int i) const { return rd.data[i] & 0xff; }
+    unsigned char data1(unsigned int i) const { return (rd.data[i] >> 8) & 0xff; }
+    unsigned char data2(unsigned int i) const { return (rd.data[i] >> 16) & 0xff; }
+    int tempo(unsigned int i) const { return rd.data[i]; }
+    // points into the arena, valid until the next push or clear
+    const unsigned char *sysex_data(unsigned int i) const {
+        const struct sysex_ref &ref = rd.sysex[rd.data[i]];
+        return ref.length ? rd.arena + ref.offset : 0;
+    }
+    unsigned int sysex_length(unsigned int i) const { return rd.sysex[rd.data[i]].length; }
+
+    unsigned long bytes() const {
+        // a mapped cache file counts whole, though only the pages read are in memory
+        unsigned long n = ticks.capacity() * sizeof(unsigned int) + types.capacity() +
+                          ports.capacity() + data.capacity() * sizeof(unsigned int) +
+                          sysex.capacity() * sizeof(struct sysex_ref) + arena.capacity() +
+                          first_in.capacity() * sizeof(unsigned int) + map_bytes;
+        return n;
+    }
+
+private:
+    struct sysex_ref {
+        unsigned int offset;            // first byte in arena
+        unsigned int length;
+    };
+
+    template <class T>
+    static void gather_array(std::vector<T> &dst, std::vector<T> &src, const std::vector<unsigned int> &order) {
+        std::vector<T>(order.size()).swap(dst);
+        for (unsigned int i = 0; i < order.size(); ++i)
+            dst[i] = src[order[i]];
+        std::vector<T>().swap(src);
+    }
+    void push(unsigned int tick, unsigned char type, unsigned char port, unsigned int word) {
+        own();
+        ticks.push_back(tick);
+        types.push_back(type);
+        ports.push_back(port);
+        data.push_back(word);
+        point();
+    }
+    void point() {
+        // the accessors read the arrays again, after they have changed
+        rd.ticks = ticks.empty() ? 0 : &ticks[0];
+        rd.types = types.empty() ? 0 : &types[0];
+        rd.ports = ports.empty() ? 0 : &ports[0];
+        rd.data = data.empty() ? 0 : &data[0];
+        rd.sysex = sysex.empty() ? 0 : &sysex[0];
+        rd.arena = arena.empty() ? 0 : &arena[0];
+        rd.n = ticks.size();
+        rd.sysex_n = sysex.size();
+        rd.arena_n = arena.size();
+    }
+    void copy(const EVENT_STORE &src) {
+        // the arrays take src's events, wherever src reads them from
+        ticks.assign(src.rd.ticks, src.rd.ticks + src.rd.n);
+        types.assign(src.rd.types, src.rd.types + src.rd.n);
+        ports.assign(src.rd.ports, src.rd.ports + src.rd.n);
+        data.assign(src.rd.data, src.rd.data + src.rd.n);
+        sysex.assign(src.rd.sysex, src.rd.sysex + src.rd.sysex_n);
+        arena.assign(src.rd.arena, src.rd.arena + src.rd.arena_n);
+        first_in = src.first_in;
+        bucket = src.bucket;
+        point();
+    }
+    void own() {
+        // a mapped store is copied into the arrays before it is written
+        if (!map)
+            return;
+        copy(*this);
+        unmap();
+    }
+    void unmap() {
+        if (map)
+            munmap(map, map_bytes);
+        map = 0;
+        map_bytes = 0;
+    }
+
+    std::vector<unsigned int> ticks;
+    std::vector<unsigned char> types;       // SND_SEQ_EVENT_xxx
+    std::vector<unsigned char> ports;       // port index
+    std::vector<unsigned int> data;
+    std::vector<struct sysex_ref> sysex;
+    std::vector<unsigned char> arena;       // every sysex payload of the song
+    std::vector<unsigned int> first_in;     // tick index, see index_ticks()
+    unsigned int bucket;                    // ticks per index entry
+    struct {                                // what the accessors read
+        const unsigned int *ticks;
+        const unsigned char *types;
+        const unsigned char *ports;
+        const unsigned int *data;
+        const struct sysex_ref *sysex;
+        const unsigned char *arena;
+        unsigned int n;
+        unsigned int sysex_n;
+        unsigned long arena_n;
+    } rd;
+    void *map;                              // song cache file the arrays are read from, or 0
+    unsigned long map_bytes;
+};  // end class EVENT_STORE
+
+// stands in for a store to count what would go into it
+struct event_count {
+    unsigned int events;
+    unsigned int sysex;
+    unsigned long sysex_bytes;
+    event_count() : events(0), sysex(0), sysex_bytes(0) {}
+    unsigned int size() const { return events; }
+    void push_channel(unsigned int, unsigned char, unsigned char, unsigned char, unsigned char, unsigned char = 0) {
+        ++events;
+    }
+    void push_tempo(unsigned int, unsigned char, int) { ++events; }
+    void push_sysex(unsigned int, unsigned char, const unsigned char *, unsigned int head_len,
+                    const unsigned char *, unsigned int body_len) {
+        ++events;
+        ++sysex;
+        sysex_bytes += head_len + body_len;
+    }
+};
+
+#endif // EVENT_STORE_H
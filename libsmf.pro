@@ -0,0 +1,20 @@
+# -------------------------------------------------
+# libsmf: the Standard MIDI File decoder and song cache,
+# without Qt, for MIDI_PLAY and for tools that link it
+# -------------------------------------------------
+CONFIG -= qt
+CONFIG += staticlib
+TARGET = smf
+TEMPLATE = lib
+SOURCES += smf_decoder.cpp \
+    song_cache.cpp \
+    chase.cpp \
+    tempo_map.cpp \
+    meters.cpp
+HEADERS += smf_decoder.h \
+    event_store.h \
+    song_cache.h \
+    chase.h \
+    tempo_map.h \
+    meters.h
+LIBS += -lpthread
@@ -0,0 +1,91 @@
+// meters.cpp -- part of MIDI_PLAY, built into libsmf.a
+// the meter timeline, see meters.h. No Qt, no ALSA calls.
+// contains:
+//      build()     -- one pass over the song, closing a bucket as the events leave it
+//      end_bucket() -- the frame at the end of a bucket, and of the quiet ones after it
+//      keep()      -- add a frame where it starts, if it differs from the one before
+
+#include "meters.h"
+#include <string.h>
+#include <math.h>
+
+void METER_TIMELINE::build(const EVENT_STORE &events, const TEMPO_MAP &tempo_map) {
+    // the meters are changed as the display changed them from the events
+    // as they went past; a note too short to last to the end of its bucket
+    // still shows, as the bucket keeps the highest level each channel had
+    struct meter_frame state;
+    unsigned char peak[16];
+    memset(&state, 0, sizeof(state));
+    memset(peak, 0, sizeof(peak));
+    clear();
+    if (!events.size())
+        return;
+    // buckets are counted in a double: one long delta can make a song
+    // longer than an unsigned int of buckets
+    double bucket = 0;
+    keep(state, 0);
+    for (unsigned int i = 0; i < events.size(); ++i) {
+        unsigned char type = events.type(i);
+        if (type != SND_SEQ_EVENT_CONTROLLER && type != SND_SEQ_EVENT_NOTEON && type != SND_SEQ_EVENT_NOTEOFF)
+            continue;
+        double b = floor(tempo_map.usec_at(events.tick(i)) / METER_BUCKET_USEC);
+        if (b > bucket) {
+            end_bucket(state, peak, bucket);
+            bucket = b;
+        }
+        int ch = events.channel(i) & 0x0f;
+        int vol = state.volume[ch], expr = state.expression[ch], level = state.level[ch];
+        int value = events.data2(i);
+        if (type == SND_SEQ_EVENT_CONTROLLER) {
+            if (events.data1(i) == 7) {
+                vol = value;
+                if (level)
+                    level = (level + expr + vol) / (expr ? 3 : 2);
+            }
+            else if (events.data1(i) == 0x0b) {
+                expr = value;
+                if (level)
+                    level = (level + expr + vol) / (vol ? 3 : 2);
+            }
+            else
+                continue;
+        }
+        else if (type == SND_SEQ_EVENT_NOTEON)
+            level = (value + expr + vol) / (1 + (expr ? 1 : 0) + (vol ? 1 : 0));
+        else
+            level = 0;
+        state.volume[ch] = vol;
+        state.expression[ch] = expr;
+        state.level[ch] = level;
+        if (level > peak[ch])
+            peak[ch] = level;
+    }
+    // at() keeps to the last frame past the end
+    end_bucket(state, peak, bucket);
+}   // end build
+
+void METER_TIMELINE::end_bucket(const struct meter_frame &state, unsigned char *peak, double bucket) {
+    // the bucket shows the highest levels it had; the quiet buckets up to
+    // the next event show the state it ended in
+    struct meter_frame f = state;
+    for (int ch = 0; ch < 16; ++ch) {
+        if (peak[ch] > f.level[ch])
+            f.level[ch] = peak[ch];
+        peak[ch] = state.level[ch];     // the next bucket starts from here
+    }
+    keep(f, bucket);
+    keep(state, bucket + 1);
+}   // end end_bucket
+
+void METER_TIMELINE::keep(const struct meter_frame &frame, double bucket) {
+    double start = bucket * METER_BUCKET_USEC;
+    if (!starts.empty() && starts.back() == start) {
+        // a bucket with events replaces the quiet frame put there before it
+        frames.pop_back();
+        starts.pop_back();
+    }
+    if (!frames.empty() && !memcmp(&frame, &frames.back(), sizeof(frame)))
+        return;
+    frames.push_back(frame);
+    starts.push_back(start);
+}   // end keep
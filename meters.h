@@ -0,0 +1,79 @@
+// meters.h -- part of MIDI_PLAY, built into libsmf.a
+// what the mixer's meters show through the song: for each channel its
+// volume (CC 7), expression (CC 11) and level, the last note's velocity
+// averaged with the two as the display has always done, set to nothing by
+// the note off. It is worked out once when the song is loaded, as one
+// frame of all 16 channels for every METER_BUCKET_USEC of the song, so the
+// display reads one frame where the song is, playing or just moved. Only
+// the buckets where the frame changes are kept, with the time they start,
+// so a song takes room for its meter changes, not for its length.
+// contains:
+//      meter_frame -- the meters of all channels at one time
+//      METER_TIMELINE -- the frames of one song
+//      build()     -- take the frames from a song's events
+//      at()        -- the frame for a time of the song, or near the last one asked
+
+#ifndef METERS_H
+#define METERS_H
+
+#include "event_store.h"
+#include "tempo_map.h"
+#include <vector>
+#include <algorithm>
+
+// time of the song each frame stands for, usec
+#define METER_BUCKET_USEC 10000
+
+struct meter_frame {
+    unsigned char level[16];            // 0..127 by channel, 0 while no note sounds
+    unsigned char volume[16];
+    unsigned char expression[16];
+};
+
+class METER_TIMELINE {
+public:
+    void clear() {
+        std::vector<struct meter_frame>().swap(frames);
+        std::vector<double>().swap(starts);
+    }
+    bool empty() const { return frames.empty(); }
+    void build(const EVENT_STORE &events, const TEMPO_MAP &tempo_map);
+    // the meters at the end of the bucket usec falls in; 0 if there are none
+    const struct meter_frame *at(double usec) const {
+        if (frames.empty())
+            return 0;
+        unsigned int k = std::upper_bound(starts.begin(), starts.end(), usec) - starts.begin();
+        return &frames[k ? k - 1 : 0];
+    }
+    // the same for the display, which asks a frame or so further on each
+    // time: cursor is the caller's, left at the frame found and looked at
+    // first the next time, so playing on costs no search
+    const struct meter_frame *at(double usec, unsigned int &cursor) const {
+        if (frames.empty())
+            return 0;
+        unsigned int k = cursor;
+        if (k < starts.size() && starts[k] <= usec) {
+            if (k + 1 == starts.size() || usec < starts[k + 1])
+                return &frames[k];
+            if (k + 2 == starts.size() || usec < starts[k + 2]) {
+                cursor = k + 1;
+                return &frames[k + 1];
+            }
+        }
+        k = std::upper_bound(starts.begin(), starts.end(), usec) - starts.begin();
+        cursor = k ? k - 1 : 0;
+        return &frames[cursor];
+    }
+    unsigned long bytes() const {
+        return frames.capacity() * sizeof(struct meter_frame) + starts.capacity() * sizeof(double);
+    }
+
+private:
+    void keep(const struct meter_frame &frame, double bucket);
+    void end_bucket(const struct meter_frame &state, unsigned char *peak, double bucket);
+
+    std::vector<struct meter_frame> frames;     // each differs from the one before
+    std::vector<double> starts;                 // by frame, usec of the bucket it starts at
+};  // end class METER_TIMELINE
+
+#endif // METERS_H
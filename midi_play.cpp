@@ -2,9 +2,17 @@
 /* Function list:
  *   MIDI_PLAY     -- constructor
  *  ~MIDI_PLAY     -- destructor
+ *  command       -- engine command for the open sequencer and port
  *  startPlayer
  *  stopPlayer
+ *  post_tempo     -- tell the engine the tempo scale or override
+ *  show_tempo     -- Tempo slider and song length at the scale
+ *  play_seconds   -- time into the song a tick plays at, at the scale
  *  on_Open_button_clicked   -- SLOT
+ *  loadProgress   -- SLOT
+ *  songPlayable   -- SLOT, the song is in, Play is enabled
+ *  songLoaded   -- SLOT, the loader is done, meters and all
+ *  playerFailed   -- SLOT
  *  on_Play_button_toggled   -- SLOT
  *  on_Pause_button_toggled   -- SLOT
  *  on_Panic_button_clicked   -- SLOT
@@ -13,53 +21,23 @@
  *  on_progressBar_sliderReleased   -- SLOT
  *  on_progressBar_sliderMoved   -- SLOT
  *  on_MIDI_Tempo_Master_valueChanged   -- SLOT
+ *  on_MIDI_Tempo_Hold_toggled   -- SLOT
  *  on_MIDI_Volume_Master_valueChanged   -- SLOT
  *  on_MIDI_Exit_button_clicked()   -- SLOT
  *  on_MIDI_GMGS_button_toggled()   -- SLOT
  *  on_MIDI_Transpose_valueChanged(int)   -- SLOT
- * Volume controlled by CC "Bx 07 nn"
- *  on_MIDI_Volume_1_valueChanged(int)   -- SLOT
- *  on_MIDI_Volume_2_valueChanged(int)   -- SLOT
- *  on_MIDI_Volume_3_valueChanged(int)   -- SLOT
- *  on_MIDI_Volume_4_valueChanged(int)   -- SLOT
- *  on_MIDI_Volume_5_valueChanged(int)   -- SLOT
- *  on_MIDI_Volume_6_valueChanged(int)   -- SLOT
- *  on_MIDI_Volume_7_valueChanged(int)   -- SLOT
- *  on_MIDI_Volume_8_valueChanged(int)   -- SLOT
- *  on_MIDI_Volume_9_valueChanged(int)   -- SLOT
- *  on_MIDI_Volume_10_valueChanged(int)   -- SLOT
- *  on_MIDI_Volume_11_valueChanged(int)   -- SLOT
- *  on_MIDI_Volume_12_valueChanged(int)   -- SLOT
- *  on_MIDI_Volume_13_valueChanged(int)   -- SLOT
- *  on_MIDI_Volume_14_valueChanged(int)   -- SLOT
- *  on_MIDI_Volume_15_valueChanged(int)   -- SLOT
- *  on_MIDI_Volume_16_valueChanged(int)   -- SLOT
- * Expression controlled by CC "Bx 0B nn"
- *  on_MIDI_Expression_1_valueChanged(int)   -- SLOT
- *  on_MIDI_Expression_2_valueChanged(int)   -- SLOT
- *  on_MIDI_Expression_3_valueChanged(int)   -- SLOT
- *  on_MIDI_Expression_4_valueChanged(int)   -- SLOT
- *  on_MIDI_Expression_5_valueChanged(int)   -- SLOT
- *  on_MIDI_Expression_6_valueChanged(int)   -- SLOT
- *  on_MIDI_Expression_7_valueChanged(int)   -- SLOT
- *  on_MIDI_Expression_8_valueChanged(int)   -- SLOT
- *  on_MIDI_Expression_9_valueChanged(int)   -- SLOT
- *  on_MIDI_Expression_10_valueChanged(int)   -- SLOT
- *  on_MIDI_Expression_11_valueChanged(int)   -- SLOT
- *  on_MIDI_Expression_12_valueChanged(int)   -- SLOT
- *  on_MIDI_Expression_13_valueChanged(int)   -- SLOT
- *  on_MIDI_Expression_14_valueChanged(int)   -- SLOT
- *  on_MIDI_Expression_15_valueChanged(int)   -- SLOT
- *  on_MIDI_Expression_16_valueChanged(int)   -- SLOT
+ *  on_mixer_changed   -- SLOT, a channel's Volume (CC "Bx 07 nn") or
+ *                      Expression (CC "Bx 0B nn") moved by hand
  *  tickDisplay   -- SLOT
  *  check_snd       -- INLINE
- *  read_id   -- INLINE
  *  send_CC
  *  send_SysEx
  *  init_seq
  *  close_seq
  *  connect_port
  *  disconnect_port
+ *  parse_ports    -- the PortBox port and the MIDI_PLAY_PORTS ones
+ *  getRoutes      -- channel routing from MIDI_PLAY_ROUTE
  *  getRawDev
  *  getPorts
  */
@@ -68,8 +46,6 @@
 #include <alsa/asoundlib.h>
 #include <unistd.h>
 #include <sys/types.h>
-#include <signal.h>
-#include <sys/wait.h>
 #include <vector>
 #include <algorithm>
 #include <QtDebug>
@@ -81,14 +57,12 @@
 // STATIC vars
 snd_seq_t *MIDI_PLAY::seq=0;
 snd_seq_addr_t *MIDI_PLAY::ports=0;
+int MIDI_PLAY::port_count=0;
 snd_seq_queue_tempo_t *MIDI_PLAY::queue_tempo=0;
 double MIDI_PLAY::song_length_seconds=0;
-unsigned int MIDI_PLAY::event_num=0;
 
 // FILE global vars
-snd_seq_queue_status_t *status;
 char playfile[PATH_MAX];
-pid_t pid=0;
 char port_name[16];
 char MIDI_dev[16];
 int old_tempo;
@@ -99,9 +73,6 @@ void MIDI_PLAY::check_snd(const char *operation, int err)
     if (err < 0)
         QMessageBox::critical(this, "MIDI Sequencer", QString("Cannot %1\n%2") .arg(operation) .arg(snd_strerror(err)));
 }
-int MIDI_PLAY::read_id(void) {
-    return read_32_le();
-}
 
 // constructor
 MIDI_PLAY::MIDI_PLAY(QWidget *parent) :
@@ -109,9 +80,30 @@ MIDI_PLAY::MIDI_PLAY(QWidget *parent) :
     ui(new Ui::MIDI_PLAY)
 {
     ui->setupUi(this);
+    streaming = false;
+    loader = 0;
+    tempo_scale = 1.0;
+    tempo_override = 0;
+    shown_seconds = -1;
+    tempo_cursor = 0;
+    meter_cursor = 0;
+    shown_frame = 0;
+    // the engine thread lives as long as the window, and so does its
+    // output: MIDI_PLAY_OUTPUT is "seq" (the default), "raw:<device>",
+    // "capture" or "null", see output.h
+    player = new PLAYER(all_events, decoder, chase, tempo_map, MIDI_OUTPUT::create(getenv("MIDI_PLAY_OUTPUT")), this);
+    connect(player, SIGNAL(failed(QString)), this, SLOT(playerFailed(QString)));
+    // how far ahead of the queue the song is sent, msec
+    if (getenv("MIDI_PLAY_LOOKAHEAD"))
+        player->set_lookahead(atoi(getenv("MIDI_PLAY_LOOKAHEAD")));
+    // the display follows the engine, at most this many times a second
+    if (getenv("MIDI_PLAY_FPS"))
+        player->set_frame_rate(atoi(getenv("MIDI_PLAY_FPS")));
+    connect(player, SIGNAL(moved()), this, SLOT(tickDisplay()));
+    player->start();
+    getRoutes();
     ui->progressBar->setEnabled(false);
     ui->MIDI_Transpose->setEnabled(false);
-    timer = new QTimer(this);
     memset(MIDI_dev,0,sizeof(MIDI_dev));
     memset(port_name,0,sizeof(port_name));
 
@@ -119,66 +111,109 @@ MIDI_PLAY::MIDI_PLAY(QWidget *parent) :
     queue = snd_seq_alloc_named_queue(seq, "midi_play");
     check_snd("create queue", queue);
     getPorts();     // empty parm means fill in the PortBox list
-    snd_seq_queue_status_malloc(&status);
     close_seq();
 }   // end constructor
 
 MIDI_PLAY::~MIDI_PLAY()
 {
+    if (loader) {
+        loader->cancel();
+        loader->wait();
+    }
     ui->Play_button->setChecked(false);
+    delete player;      // ends the engine thread
+    player = 0;
     if (seq && queue) snd_seq_free_queue(seq, queue);
     close_seq();
     delete ui;
 }   // end destructor
 
-void MIDI_PLAY::startPlayer(int startTick) {
-    if (pid>0) 
-      return;
-    pid=fork();
-    if (!pid) {
-        play_midi(startTick);
-        exit(EXIT_SUCCESS);
-    }   // end pid fork
+struct player_cmd MIDI_PLAY::command(int op) {
+    struct player_cmd cmd(op, seq, queue, ports, port_count);
+    cmd.ppq = static_cast<int>(PPQ);
+    for (int p = 0; p < SONG_PORTS; ++p)
+        for (int c = 0; c < 16; ++c)
+            if (route[p][c] != 0xff)
+                cmd.route[p][c] = route[p][c];
+    return cmd;
+}
+
+void MIDI_PLAY::startPlayer(int startTick, bool resume) {
+    // the engine starts (or continues) the queue and plays from startTick
+    struct player_cmd cmd = command(resume ? player_cmd::RESUME : player_cmd::PLAY);
+    cmd.tick = startTick;
+    cmd.transpose = ui->MIDI_Transpose->value();
+    cmd.tempo_scale = tempo_scale;
+    cmd.tempo_override = ui->MIDI_Tempo_Hold->isChecked() ? tempo_override : 0;
+    cmd.streaming = streaming;
+    player->post(cmd);
+}
+
+void MIDI_PLAY::post_tempo() {
+    // the engine puts it on the queue at once, playing or not
+    struct player_cmd cmd = command(player_cmd::TEMPO);
+    cmd.tempo_scale = tempo_scale;
+    cmd.tempo_override = ui->MIDI_Tempo_Hold->isChecked() ? tempo_override : 0;
+    player->post(cmd);
+}
+
+void MIDI_PLAY::show_tempo() {
+    // the slider follows the song's tempo at the scale, unless it is held;
+    // the song gets longer or shorter with it
+    if (!ui->MIDI_Tempo_Hold->isChecked()) {
+        int bpm = static_cast<int>(old_tempo * tempo_scale + 0.5);
+        ui->MIDI_Tempo_Master->blockSignals(true);
+        ui->MIDI_Tempo_Master->setValue(bpm);
+        ui->MIDI_Tempo_Master->blockSignals(false);
+        ui->MIDI_Tempo_Master_display->display(bpm);
+    }
+    if (streaming || !all_events.last_tick())
+        return;
+    int length = static_cast<int>(play_seconds(all_events.last_tick()));
+    ui->MIDI_length_display->setText(QString::number(length/60).rightJustified(2,'0') + ":" + QString::number(length%60).rightJustified(2,'0'));
+}
+
+double MIDI_PLAY::play_seconds(unsigned int tick) {
+    // the song's own timing, slowed down or sped up by the scale; held,
+    // every tick takes the same time
+    if (ui->MIDI_Tempo_Hold->isChecked() && tempo_override && PPQ)
+        return tick * (tempo_override / 1000000.0) / PPQ;
+    double seconds = tempo_map.usec_at(tick) / 1000000.0;
+    return tempo_scale > 0 ? seconds/tempo_scale : seconds;
 }
 
 void MIDI_PLAY::stopPlayer() {
-    if (pid) {
-        kill(pid,SIGKILL);
-        waitpid(pid,NULL,0);
-    }
-    pid = 0;
-    snd_seq_drop_output(seq);
-    snd_seq_drain_output(seq);
+    // returns once the engine has stopped sending and stopped the queue
+    player->stop(command(player_cmd::STOP));
 }
 
 //  FUNCTIONS
-void MIDI_PLAY::send_CC(char * buf,int data_size) {
-    snd_seq_event_t ev;
-    snd_seq_ev_clear(&ev);
-    ev.type = SND_SEQ_EVENT_CONTROLLER;
-    ev.dest = ports[0];
-    ev.data.control.channel = buf[0];   // channel number
+void MIDI_PLAY::send_CC(char * buf,int data_size, int to) {
+    // straight out through the engine's lane, playing or not; a slider
+    // moved faster than the engine gets to it sends its last value only.
+    // To where the channel is routed, or to destination 'to'
+    struct player_cmd cmd = command(player_cmd::SEND);
+    cmd.ev.type = SND_SEQ_EVENT_CONTROLLER;
+    cmd.ev.dest = to >= 0 && to < cmd.dests ? cmd.dest[to] : cmd.dest_for(0, buf[0] & 0x0f);
+    cmd.ev.data.control.channel = buf[0];   // channel number
     if (data_size>1)
-      ev.data.control.param = buf[1];   // controller number
+      cmd.ev.data.control.param = buf[1];   // controller number
     if (data_size==3)
-      ev.data.control.value = buf[2];   // controller value
-    snd_seq_ev_set_fixed(&ev);
-    snd_seq_ev_set_direct(&ev);
-    snd_seq_event_output_direct(seq, &ev);
-    snd_seq_drain_output(seq);
+      cmd.ev.data.control.value = buf[2];   // controller value
+    snd_seq_ev_set_fixed(&cmd.ev);
+    player->inject(cmd);
 }   // end send_CC
 
 void MIDI_PLAY::send_SysEx(char * buf,int data_size) {
-    if (ui->Play_button->isChecked()) on_Pause_button_toggled(true);
-    snd_seq_event_t ev;
-    snd_seq_ev_clear(&ev);
-    ev.type = SND_SEQ_EVENT_SYSEX;
-    ev.dest = ports[0];
-    snd_seq_ev_set_variable(&ev, data_size, buf);
-    snd_seq_ev_set_direct(&ev);
-    snd_seq_event_output_direct(seq, &ev);
-    snd_seq_drain_output(seq);
-    if (ui->Play_button->isChecked()) on_Pause_button_toggled(false);
+    // the engine sends it between the events of the song, ahead of its
+    // commands, no need to pause; to every destination
+    struct player_cmd cmd = command(player_cmd::SEND);
+    cmd.ev.type = SND_SEQ_EVENT_SYSEX;
+    cmd.sysex.assign(buf, buf + data_size);
+    for (int d = 0; d < cmd.dests; ++d) {
+        cmd.ev.dest = cmd.dest[d];
+        player->inject(cmd);
+    }
 }   // end send_SysEx
 
 void MIDI_PLAY::init_seq() {
@@ -193,6 +228,9 @@ void MIDI_PLAY::init_seq() {
 }
 
 void MIDI_PLAY::close_seq() {
+    // the engine must be done with the handle first
+    if (player)
+        player->sync();
     if (seq) {
         snd_seq_stop_queue(seq,queue,NULL);
         snd_seq_drop_output(seq);
@@ -218,31 +256,73 @@ void MIDI_PLAY::connect_port() {
         int err = snd_seq_create_port(seq, pinfo);
         check_snd("create port", err);
 	
-        ports = (snd_seq_addr_t *)realloc(ports, sizeof(snd_seq_addr_t));
-        err = snd_seq_parse_address(seq, &ports[0], port_name);
-        if (err < 0) {
-            QMessageBox::critical(this, "MIDI Sequencer", QString("Invalid port%1\n%2") .arg(port_name) .arg(snd_strerror(err)));
+        if (parse_ports() < 0)
             return;
+        for (int i = 0; i < port_count; ++i) {
+            err = snd_seq_connect_to(seq, 0, ports[i].client, ports[i].port);
+            if (err < 0 && err!= -16)
+                QMessageBox::critical(this, "MIDI Sequencer", QString("%4 Cannot connect to port %1:%2 - %3") .arg(ports[i].client) .arg(ports[i].port) .arg(strerror(errno)) .arg(err));
         }
-        err = snd_seq_connect_to(seq, 0, ports[0].client, ports[0].port);
-        if (err < 0 && err!= -16)
-            QMessageBox::critical(this, "MIDI Sequencer", QString("%4 Cannot connect to port %1:%2 - %3") .arg(ports[0].client) .arg(ports[0].port) .arg(strerror(errno)) .arg(err));
     }
 }   // end connect_port
 
 void MIDI_PLAY::disconnect_port() {
     if (seq && strlen(port_name)) {
-        int err;
-        ports = (snd_seq_addr_t *)realloc(ports, sizeof(snd_seq_addr_t));
-        err = snd_seq_parse_address(seq, &ports[0], port_name);
-        if (err < 0) {
-            QMessageBox::critical(this, "MIDI Sequencer", QString("Invalid port%1\n%2") .arg(port_name) .arg(snd_strerror(err)));
+        if (parse_ports() < 0)
             return;
-        }
-        err = snd_seq_disconnect_to(seq, 0, ports[0].client, ports[0].port);
+        for (int i = 0; i < port_count; ++i)
+            snd_seq_disconnect_to(seq, 0, ports[i].client, ports[i].port);
     }   // end if seq
 }   // end disconnect_port
 
+int MIDI_PLAY::parse_ports() {
+    // the PortBox port, then the ports listed in MIDI_PLAY_PORTS (client:port
+    // or name, comma separated); song port n goes to the n'th of them
+    ports = (snd_seq_addr_t *)realloc(ports, MAX_DESTS * sizeof(snd_seq_addr_t));
+    port_count = 0;
+    int err = snd_seq_parse_address(seq, &ports[0], port_name);
+    if (err < 0) {
+        QMessageBox::critical(this, "MIDI Sequencer", QString("Invalid port%1\n%2") .arg(port_name) .arg(snd_strerror(err)));
+        return err;
+    }
+    port_count = 1;
+    if (!getenv("MIDI_PLAY_PORTS"))
+        return 0;
+    char list[256], *save;
+    strncpy(list, getenv("MIDI_PLAY_PORTS"), sizeof(list)-1);
+    list[sizeof(list)-1] = 0;
+    for (char *name = strtok_r(list, ",", &save); name && port_count < MAX_DESTS; name = strtok_r(NULL, ",", &save)) {
+        err = snd_seq_parse_address(seq, &ports[port_count], name);
+        if (err < 0)
+            QMessageBox::critical(this, "MIDI Sequencer", QString("Invalid port%1\n%2") .arg(name) .arg(snd_strerror(err)));
+        else
+            ++port_count;
+    }
+    return 0;
+}   // end parse_ports
+
+void MIDI_PLAY::getRoutes() {
+    // MIDI_PLAY_ROUTE sends channels to other ports than their song port's:
+    // "channel=dest" for every song port, "port/channel=dest" for one;
+    // channels 1-16, dest counts from 0, the PortBox port
+    memset(route, 0xff, sizeof(route));
+    if (!getenv("MIDI_PLAY_ROUTE"))
+        return;
+    char list[256], *save;
+    strncpy(list, getenv("MIDI_PLAY_ROUTE"), sizeof(list)-1);
+    list[sizeof(list)-1] = 0;
+    for (char *entry = strtok_r(list, ",", &save); entry; entry = strtok_r(NULL, ",", &save)) {
+        unsigned int p, c, d;
+        if (sscanf(entry, "%u/%u=%u", &p, &c, &d) == 3 && p < SONG_PORTS && c >= 1 && c <= 16 && d < MAX_DESTS)
+            route[p][c-1] = d;
+        else if (sscanf(entry, "%u=%u", &c, &d) == 2 && c >= 1 && c <= 16 && d < MAX_DESTS)
+            for (p = 0; p < SONG_PORTS; ++p)
+                route[p][c-1] = d;
+        else
+            QMessageBox::warning(this, "MIDI Sequencer", QString("MIDI_PLAY_ROUTE: can't use %1") .arg(entry));
+    }
+}   // end getRoutes
+
 void MIDI_PLAY::getPorts(QString buf) {
     // fill in the combobox with all available ports
     // or set port_name to the port passed in buf
@@ -339,26 +419,15 @@ void MIDI_PLAY::getRawDev(QString buf) {
 //  SLOTS
 void MIDI_PLAY::on_Open_button_clicked()
 {
-    struct tempo_chg tc;
+    // while a song is loading the button cancels the load
+    if (loader) {
+        loader->cancel();
+        return;
+    }
     ui->Play_button->setChecked(false);
     ui->Play_button->setEnabled(false);
     ui->Pause_button->setEnabled(false);
-    ui->TrackVol_1->setEnabled(false);
-    ui->TrackVol_2->setEnabled(false);
-    ui->TrackVol_3->setEnabled(false);
-    ui->TrackVol_4->setEnabled(false);
-    ui->TrackVol_5->setEnabled(false);
-    ui->TrackVol_6->setEnabled(false);
-    ui->TrackVol_7->setEnabled(false);
-    ui->TrackVol_8->setEnabled(false);
-    ui->TrackVol_9->setEnabled(false);
-    ui->TrackVol_10->setEnabled(false);
-    ui->TrackVol_11->setEnabled(false);
-    ui->TrackVol_12->setEnabled(false);
-    ui->TrackVol_13->setEnabled(false);
-    ui->TrackVol_14->setEnabled(false);
-    ui->TrackVol_15->setEnabled(false);
-    ui->TrackVol_16->setEnabled(false);
+    ui->mixer->set_channels(0);
     ui->MidiFile_display->clear();
     ui->MIDI_KeySig->clear();
     ui->MIDI_Transpose->setValue(0);
@@ -377,88 +446,96 @@ void MIDI_PLAY::on_Open_button_clicked()
     check_snd("create queue", queue);
     connect_port();
     all_events.clear();
-    if (!parseFile(playfile)) {
-        QMessageBox::critical(this, "MIDI Sequencer", QString("Invalid file"));
+    chase.clear();
+    tempo_map.clear();
+    meters.clear();
+    // let the engine drop the old song's image before the store fills again
+    player->stop(command(player_cmd::SONG));
+    // the song loads on a thread of its own; songPlayable() takes it on as
+    // soon as it can be played, songLoaded() when the loader is done
+    loader = new SONG_LOADER(decoder, all_events, chase, tempo_map, meters, song, this);
+    connect(loader, SIGNAL(progress(int)), this, SLOT(loadProgress(int)));
+    connect(loader, SIGNAL(playable()), this, SLOT(songPlayable()));
+    connect(loader, SIGNAL(finished()), this, SLOT(songLoaded()));
+    ui->Open_button->setText("&Cancel");
+    loader->load(playfile);
+}   // end on_Open_button_clicked
+
+void MIDI_PLAY::loadProgress(int percent) {
+    ui->MIDI_length_display->setText(QString::number(percent) + "%");
+}   // end loadProgress
+
+void MIDI_PLAY::songPlayable()
+{
+    // the loader goes on with the meters and the song cache, another song
+    // can't be opened until it is done
+    int ok = finishLoad();
+    ui->Open_button->setText("&Open");
+    ui->Open_button->setEnabled(false);
+    // the display starts afresh with the new song
+    shown_seconds = -1;
+    tempo_cursor = 0;
+    meter_cursor = 0;
+    shown_frame = 0;
+    if (!ok) {
+        ui->MIDI_length_display->setText("00:00");
         return;
-    }   // parseFile
-    for (std::vector<event>::iterator Event=all_events.begin(); Event!=all_events.end(); ++Event)  {
-      // create table of tempo changes
-      if (Event->type == SND_SEQ_EVENT_TEMPO) {
-	tc.tick = Event->tick;
-	tc.new_tempo = 60000000/Event->data.tempo;
-	tempoTable.push_back(tc);
-      }
-      // enable tracks that have notes
-      if (Event->type == SND_SEQ_EVENT_NOTEON) {
-	switch(Event->data.d[0]) {
-	  case 0:
-	  ui->TrackVol_1->setEnabled(true);
-	  break;
-	  case 1:
-	  ui->TrackVol_2->setEnabled(true);
-	  break;
-	  case 2:
-	  ui->TrackVol_3->setEnabled(true);
-	  break;
-	  case 3:
-	  ui->TrackVol_4->setEnabled(true);
-	  break;
-	  case 4:
-	  ui->TrackVol_5->setEnabled(true);
-	  break;
-	  case 5:
-	  ui->TrackVol_6->setEnabled(true);
-	  break;
-	  case 6:
-	  ui->TrackVol_7->setEnabled(true);
-	  break;
-	  case 7:
-	  ui->TrackVol_8->setEnabled(true);
-	  break;
-	  case 8:
-	  ui->TrackVol_9->setEnabled(true);
-	  break;
-	  case 9:
-	  ui->TrackVol_10->setEnabled(true);
-	  break;
-	  case 10:
-	  ui->TrackVol_11->setEnabled(true);
-	  break;
-	  case 11:
-	  ui->TrackVol_12->setEnabled(true);
-	  break;
-	  case 12:
-	  ui->TrackVol_13->setEnabled(true);
-	  break;
-	  case 13:
-	  ui->TrackVol_14->setEnabled(true);
-	  break;
-	  case 14:
-	  ui->TrackVol_15->setEnabled(true);
-	  break;
-	  case 15:
-	  ui->TrackVol_16->setEnabled(true);
-	  break;
-	  default:
-	    break;
-	} // end switch
-      } // end if SND_SEQ_EVENT_NOTEON
-      // set initial track VOLUME/EXPRESSION levels
-      if (Event->type == SND_SEQ_EVENT_CONTROLLER) {
-	
-      } // end if SND_SEQ_EVENT_CONTROLLER
-    } // end for
-    old_tempo = tempoTable.begin()->new_tempo;
-    ui->MIDI_Tempo_Master->blockSignals(true);
-    ui->MIDI_Tempo_Master->setValue(old_tempo);
-    ui->MIDI_Tempo_Master->blockSignals(false);
-    ui->MIDI_Tempo_Master_display->display(old_tempo);
-    ui->progressBar->setRange(0,all_events.back().tick);
-    ui->progressBar->setTickInterval(song_length_seconds<240? all_events.back().tick/song_length_seconds*10 : all_events.back().tick/song_length_seconds*30);
+    }
+    // the engine compiles the song for playing while the window is set up
+    player->post(command(player_cmd::SONG));
+    // channel usage comes with the song, parsed or cached
+    // enable tracks that have notes
+    ui->mixer->set_channels(song.channels & 0xffff);
+    ui->MidiFile_display->setToolTip(QString("song cache: %1 hits, %2 misses") .arg(SONG_CACHE::hits) .arg(SONG_CACHE::misses));
+    // a new song starts at its own tempo
+    old_tempo = 60000000 / tempo_map.tempo_at(0);
+    tempo_scale = 1.0;
+    ui->MIDI_Tempo_Hold->blockSignals(true);
+    ui->MIDI_Tempo_Hold->setChecked(false);
+    ui->MIDI_Tempo_Hold->blockSignals(false);
+    show_tempo();
+    if (streaming) {
+        // a stream's length isn't known until it has been played through
+        ui->progressBar->setRange(0,0);
+        ui->Play_button->setEnabled(true);
+        ui->MIDI_length_display->setText("--:--");
+        return;
+    }
+    // the slider goes by milliseconds of the song, so it moves evenly
+    // however the tempo changes
+    ui->progressBar->setRange(0,static_cast<int>(tempo_map.usec_at(all_events.last_tick())/1000));
+    ui->progressBar->setTickInterval(song_length_seconds<240? 10000 : 30000);
     ui->progressBar->setTickPosition(QSlider::TicksAbove);
     ui->Play_button->setEnabled(true);
-    ui->MIDI_length_display->setText(QString::number(static_cast<int>(song_length_seconds/60)).rightJustified(2,'0') + ":" + QString::number(static_cast<int>(song_length_seconds)%60).rightJustified(2,'0'));
-}   // end on_Open_button_clicked
+    show_tempo();
+}   // end songPlayable
+
+void MIDI_PLAY::songLoaded()
+{
+    // a song that never got to songPlayable() failed or was cancelled
+    bool ok = loader->result() == SMF_DECODER::SMF_OK;
+    if (!ok)
+        finishLoad();
+    else if (!streaming)
+        decoder.unmap();   // all data loaded, the cache written
+    loader->deleteLater();
+    loader = 0;
+    ui->Open_button->setText("&Open");
+    ui->Open_button->setEnabled(!ui->Play_button->isChecked());
+    // the meters are there now, every slider takes them from the next frame
+    meter_cursor = 0;
+    shown_frame = 0;
+    if (!ok) {
+        shown_seconds = -1;
+        tempo_cursor = 0;
+        ui->MIDI_length_display->setText("00:00");
+    }
+}   // end songLoaded
+
+void MIDI_PLAY::playerFailed(QString what) {
+    // ALSA errors from the engine thread
+    QMessageBox::critical(this, "MIDI Sequencer", what);
+}   // end playerFailed
 
 void MIDI_PLAY::on_Play_button_toggled(bool checked)
 {
@@ -466,140 +543,16 @@ void MIDI_PLAY::on_Play_button_toggled(bool checked)
         ui->Pause_button->setEnabled(true);
         ui->Open_button->setEnabled(false);
         ui->Play_button->setText("Stop");
-        ui->progressBar->setEnabled(true);
+        ui->progressBar->setEnabled(!streaming);    // no seeking in a stream
         init_seq();
         connect_port();
-        // queue won't actually start until it is drained
-        int err = snd_seq_start_queue(seq, queue, NULL);
-        check_snd("start queue", err);
-      old_tempo = tempoTable.begin()->new_tempo;
-      ui->MIDI_Tempo_Master->blockSignals(true);
-      ui->MIDI_Tempo_Master->setValue(old_tempo);
-      ui->MIDI_Tempo_Master->blockSignals(false);
-      ui->MIDI_Tempo_Master_display->display(old_tempo);
-	ui->MIDI_Volume_1->blockSignals(true);
-	ui->MIDI_Volume_1->setValue(0);
-	ui->MIDI_Volume_1->blockSignals(false);
-	ui->MIDI_Volume_2->blockSignals(true);
-	ui->MIDI_Volume_2->setValue(0);
-	ui->MIDI_Volume_2->blockSignals(false);
-	ui->MIDI_Volume_3->blockSignals(true);
-	ui->MIDI_Volume_3->setValue(0);
-	ui->MIDI_Volume_3->blockSignals(false);
-	ui->MIDI_Volume_4->blockSignals(true);
-	ui->MIDI_Volume_4->setValue(0);
-	ui->MIDI_Volume_4->blockSignals(false);
-	ui->MIDI_Volume_5->blockSignals(true);
-	ui->MIDI_Volume_5->setValue(0);
-	ui->MIDI_Volume_5->blockSignals(false);
-	ui->MIDI_Volume_6->blockSignals(true);
-	ui->MIDI_Volume_6->setValue(0);
-	ui->MIDI_Volume_6->blockSignals(false);
-	ui->MIDI_Volume_7->blockSignals(true);
-	ui->MIDI_Volume_7->setValue(0);
-	ui->MIDI_Volume_7->blockSignals(false);
-	ui->MIDI_Volume_8->blockSignals(true);
-	ui->MIDI_Volume_8->setValue(0);
-	ui->MIDI_Volume_8->blockSignals(false);
-	ui->MIDI_Volume_9->blockSignals(true);
-	ui->MIDI_Volume_9->setValue(0);
-	ui->MIDI_Volume_9->blockSignals(false);
-	ui->MIDI_Volume_10->blockSignals(true);
-	ui->MIDI_Volume_10->setValue(0);
-	ui->MIDI_Volume_10->blockSignals(false);
-	ui->MIDI_Volume_11->blockSignals(true);
-	ui->MIDI_Volume_11->setValue(0);
-	ui->MIDI_Volume_11->blockSignals(false);
-	ui->MIDI_Volume_12->blockSignals(true);
-	ui->MIDI_Volume_12->setValue(0);
-	ui->MIDI_Volume_12->blockSignals(false);
-	ui->MIDI_Volume_13->blockSignals(true);
-	ui->MIDI_Volume_13->setValue(0);
-	ui->MIDI_Volume_13->blockSignals(false);
-	ui->MIDI_Volume_14->blockSignals(true);
-	ui->MIDI_Volume_14->setValue(0);
-	ui->MIDI_Volume_14->blockSignals(false);
-	ui->MIDI_Volume_15->blockSignals(true);
-	ui->MIDI_Volume_15->setValue(0);
-	ui->MIDI_Volume_15->blockSignals(false);
-	ui->MIDI_Volume_16->blockSignals(true);
-	ui->MIDI_Volume_16->setValue(0);
-	ui->MIDI_Volume_16->blockSignals(false);
-	ui->MIDI_Expression_1->blockSignals(true);
-	ui->MIDI_Expression_1->setValue(0);
-	ui->MIDI_Expression_1->blockSignals(false);
-	ui->MIDI_Expression_2->blockSignals(true);
-	ui->MIDI_Expression_2->setValue(0);
-	ui->MIDI_Expression_2->blockSignals(false);
-	ui->MIDI_Expression_3->blockSignals(true);
-	ui->MIDI_Expression_3->setValue(0);
-	ui->MIDI_Expression_3->blockSignals(false);
-	ui->MIDI_Expression_4->blockSignals(true);
-	ui->MIDI_Expression_4->setValue(0);
-	ui->MIDI_Expression_4->blockSignals(false);
-	ui->MIDI_Expression_5->blockSignals(true);
-	ui->MIDI_Expression_5->setValue(0);
-	ui->MIDI_Expression_5->blockSignals(false);
-	ui->MIDI_Expression_6->blockSignals(true);
-	ui->MIDI_Expression_6->setValue(0);
-	ui->MIDI_Expression_6->blockSignals(false);
-	ui->MIDI_Expression_7->blockSignals(true);
-	ui->MIDI_Expression_7->setValue(0);
-	ui->MIDI_Expression_7->blockSignals(false);
-	ui->MIDI_Expression_8->blockSignals(true);
-	ui->MIDI_Expression_8->setValue(0);
-	ui->MIDI_Expression_8->blockSignals(false);
-	ui->MIDI_Expression_9->blockSignals(true);
-	ui->MIDI_Expression_9->setValue(0);
-	ui->MIDI_Expression_9->blockSignals(false);
-	ui->MIDI_Expression_10->blockSignals(true);
-	ui->MIDI_Expression_10->setValue(0);
-	ui->MIDI_Expression_10->blockSignals(false);
-	ui->MIDI_Expression_11->blockSignals(true);
-	ui->MIDI_Expression_11->setValue(0);
-	ui->MIDI_Expression_11->blockSignals(false);
-	ui->MIDI_Expression_12->blockSignals(true);
-	ui->MIDI_Expression_12->setValue(0);
-	ui->MIDI_Expression_12->blockSignals(false);
-	ui->MIDI_Expression_13->blockSignals(true);
-	ui->MIDI_Expression_13->setValue(0);
-	ui->MIDI_Expression_13->blockSignals(false);
-	ui->MIDI_Expression_14->blockSignals(true);
-	ui->MIDI_Expression_14->setValue(0);
-	ui->MIDI_Expression_14->blockSignals(false);
-	ui->MIDI_Expression_15->blockSignals(true);
-	ui->MIDI_Expression_15->setValue(0);
-	ui->MIDI_Expression_15->blockSignals(false);
-	ui->MIDI_Expression_16->blockSignals(true);
-	ui->MIDI_Expression_16->setValue(0);
-	ui->MIDI_Expression_16->blockSignals(false);
-	ui->MIDI_VolDisp_1->setValue(0);
-	ui->MIDI_VolDisp_2->setValue(0);
-	ui->MIDI_VolDisp_3->setValue(0);
-	ui->MIDI_VolDisp_4->setValue(0);
-	ui->MIDI_VolDisp_5->setValue(0);
-	ui->MIDI_VolDisp_6->setValue(0);
-	ui->MIDI_VolDisp_7->setValue(0);
-	ui->MIDI_VolDisp_8->setValue(0);
-	ui->MIDI_VolDisp_9->setValue(0);
-	ui->MIDI_VolDisp_10->setValue(0);
-	ui->MIDI_VolDisp_11->setValue(0);
-	ui->MIDI_VolDisp_12->setValue(0);
-	ui->MIDI_VolDisp_13->setValue(0);
-	ui->MIDI_VolDisp_14->setValue(0);
-	ui->MIDI_VolDisp_15->setValue(0);
-	ui->MIDI_VolDisp_16->setValue(0);
-        connect(timer, SIGNAL(timeout()), this, SLOT(tickDisplay()));
-        timer->start(25);
+      old_tempo = 60000000 / tempo_map.tempo_at(0);
+      show_tempo();
+	ui->mixer->reset();
+	shown_frame = 0;
         startPlayer(0);
     }
     else {
-        if (timer->isActive()) {
-            disconnect(timer, SIGNAL(timeout()), this, SLOT(tickDisplay()));
-            timer->stop();
-        }
-        snd_seq_stop_queue(seq,queue,NULL);
-        snd_seq_drain_output(seq);
         stopPlayer();
         on_Panic_button_clicked();
         disconnect_port();
@@ -615,57 +568,28 @@ void MIDI_PLAY::on_Play_button_toggled(bool checked)
         }
         ui->Pause_button->setEnabled(false);
         ui->Play_button->setText("Play");
-        ui->Open_button->setEnabled(true);
+        ui->Open_button->setEnabled(!loader);   // not while the loader finishes
 	ui->MIDI_Transpose->setEnabled(true);
         ui->progressBar->setEnabled(false);
-	ui->MIDI_VolDisp_1->setValue(0);
-	ui->MIDI_VolDisp_2->setValue(0);
-	ui->MIDI_VolDisp_3->setValue(0);
-	ui->MIDI_VolDisp_4->setValue(0);
-	ui->MIDI_VolDisp_5->setValue(0);
-	ui->MIDI_VolDisp_6->setValue(0);
-	ui->MIDI_VolDisp_7->setValue(0);
-	ui->MIDI_VolDisp_8->setValue(0);
-	ui->MIDI_VolDisp_9->setValue(0);
-	ui->MIDI_VolDisp_10->setValue(0);
-	ui->MIDI_VolDisp_11->setValue(0);
-	ui->MIDI_VolDisp_12->setValue(0);
-	ui->MIDI_VolDisp_13->setValue(0);
-	ui->MIDI_VolDisp_14->setValue(0);
-	ui->MIDI_VolDisp_15->setValue(0);
-	ui->MIDI_VolDisp_16->setValue(0);
-	event_num=0;
+	ui->mixer->clear_levels();
     }
 }   // end on_Play_button_toggled
 
 void MIDI_PLAY::on_Pause_button_toggled(bool checked)
 {
-    unsigned int current_tick;
     if (checked) {
-  // pause playback    
-        stopPlayer();
-        if (timer->isActive()) {
-            disconnect(timer, SIGNAL(timeout()), this, SLOT(tickDisplay()));
-            timer->stop();
-        }
-        snd_seq_get_queue_status(seq, queue, status);
-        current_tick = snd_seq_queue_status_get_tick_time(status);
-        snd_seq_stop_queue(seq,queue,NULL);
-        snd_seq_drain_output(seq);
+  // pause playback, the engine stops the queue where it is
+        player->stop(command(player_cmd::PAUSE));
         ui->Pause_button->setText("Resume");
         on_Panic_button_clicked();
     }
     else 
     {
-  // resume playback
-	snd_seq_continue_queue(seq, queue, NULL);
-        snd_seq_drain_output(seq);
-        snd_seq_get_queue_status(seq, queue, status);
-        current_tick = snd_seq_queue_status_get_tick_time(status);
+  // resume playback from where the queue stopped
+        struct player_position at;
+        player->position(at);
         ui->Pause_button->setText("Pause");
-        connect(timer, SIGNAL(timeout()), this, SLOT(tickDisplay()));
-        startPlayer(current_tick);
-        timer->start(25);
+        startPlayer(at.tick, true);
     }
 }   // end on_Pause_button_toggled
 
@@ -678,9 +602,12 @@ void MIDI_PLAY::on_Panic_button_clicked()
         buf[0] = 0xb0+x;
         buf[1] = 0x7B;	// All Notes Off (except Hold  and Sost.)
         buf[2] = 00;
-        send_CC(buf,3);
-        buf[1] = 0x79;	// Reset All Controllers (kill any Hold/Sost/etc.)
-        send_CC(buf,3);
+        for (int d = 0; d < (port_count ? port_count : 1); ++d) {
+          buf[1] = 0x7B;
+          send_CC(buf,3,d);
+          buf[1] = 0x79;	// Reset All Controllers (kill any Hold/Sost/etc.)
+          send_CC(buf,3,d);
+        }
     } // end FOR
   } // end IF SEQ
   else {
@@ -706,22 +633,7 @@ void MIDI_PLAY::on_Panic_button_clicked()
           snd_rawmidi_close(midiInHandle);
       } // end strlen(MIDI_dev)
   } // end else
-	ui->MIDI_VolDisp_1->setValue(0);
-	ui->MIDI_VolDisp_2->setValue(0);
-	ui->MIDI_VolDisp_3->setValue(0);
-	ui->MIDI_VolDisp_4->setValue(0);
-	ui->MIDI_VolDisp_5->setValue(0);
-	ui->MIDI_VolDisp_6->setValue(0);
-	ui->MIDI_VolDisp_7->setValue(0);
-	ui->MIDI_VolDisp_8->setValue(0);
-	ui->MIDI_VolDisp_9->setValue(0);
-	ui->MIDI_VolDisp_10->setValue(0);
-	ui->MIDI_VolDisp_11->setValue(0);
-	ui->MIDI_VolDisp_12->setValue(0);
-	ui->MIDI_VolDisp_13->setValue(0);
-	ui->MIDI_VolDisp_14->setValue(0);
-	ui->MIDI_VolDisp_15->setValue(0);
-	ui->MIDI_VolDisp_16->setValue(0);
+	ui->mixer->clear_levels();
 }   // end on_Panic_button_clicked
 
 void MIDI_PLAY::on_PortBox_currentIndexChanged(QString buf)
@@ -740,52 +652,32 @@ void MIDI_PLAY::on_progressBar_sliderPressed()
 void MIDI_PLAY::on_progressBar_sliderReleased()
 {
     if (!ui->Pause_button->isChecked()) return;
-    snd_seq_event_t ev;
-    snd_seq_ev_clear(&ev);
-    snd_seq_ev_set_direct(&ev);
-    snd_seq_get_queue_status(seq, queue, status);
-    // reset queue position
-    snd_seq_ev_is_tick(&ev);
-    snd_seq_ev_set_queue_pos_tick(&ev, queue, 0);
-    snd_seq_event_output(seq, &ev);
-    snd_seq_drain_output(seq);
-    // scan the event queue for the closest tick >= 'x'
-    int y = 0;
-    for (std::vector<event>::iterator Event=all_events.begin(); Event!=all_events.end(); ++Event)  {
-        if (static_cast<int>(Event->tick) >= ui->progressBar->sliderPosition()) {
-            ev.time.tick = Event->tick;
-	    event_num = y;
-            break;
-        }
-        y++;
-    }
-    ev.dest.client = SND_SEQ_CLIENT_SYSTEM;
-    ev.dest.port = SND_SEQ_PORT_SYSTEM_TIMER;
-    snd_seq_ev_set_queue_pos_tick(&ev, queue, ev.time.tick);
-    snd_seq_event_output(seq, &ev);
-    snd_seq_drain_output(seq);
-    snd_seq_real_time_t *new_time = new snd_seq_real_time_t;
-    double x = static_cast<double>(ev.time.tick)/all_events.back().tick;
-    new_time->tv_sec = (x*song_length_seconds);
-    new_time->tv_nsec = 0;
-    snd_seq_ev_set_queue_pos_real(&ev, queue, new_time);
-    ui->MIDI_time_display->setText(QString::number(static_cast<int>(new_time->tv_sec)/60).rightJustified(2,'0')+
-      ":"+QString::number(static_cast<int>(new_time->tv_sec)%60).rightJustified(2,'0'));
-    if (ui->Pause_button->isChecked()) return;
+    // the tick at the slider's time, then the closest event at or after it
+    struct player_cmd cmd = command(player_cmd::SEEK);
+    unsigned int y = all_events.find(tempo_map.tick_at(ui->progressBar->sliderPosition()*1000.0));
+    if (y < all_events.size())
+        cmd.tick = all_events.tick(y);
+    // the engine moves the stopped queue, resume plays from there; the
+    // display picks up at the new place
+    player->post(cmd);
+    shown_seconds = -1;
+    tempo_cursor = 0;
+    meter_cursor = 0;
+    shown_frame = 0;
+    int new_time = static_cast<int>(play_seconds(cmd.tick));
+    ui->MIDI_time_display->setText(QString::number(new_time/60).rightJustified(2,'0')+
+      ":"+QString::number(new_time%60).rightJustified(2,'0'));
 }   // end on_progressBar_sliderReleased
 
 void MIDI_PLAY::on_progressBar_sliderMoved(int val) {
-    double new_seconds = static_cast<double>(val)/all_events.back().tick;
-    new_seconds *= song_length_seconds;  
+    double new_seconds = play_seconds(tempo_map.tick_at(val*1000.0));
     ui->MIDI_time_display->setText(QString::number(static_cast<int>(new_seconds)/60).rightJustified(2,'0')+
     ":"+QString::number(static_cast<int>(new_seconds)%60).rightJustified(2,'0'));
 }  // end on_progressBar_sliderMoved
 
 void MIDI_PLAY::on_MIDI_Volume_Master_valueChanged(int val) {
   char buf[8];
-  bool paused = ui->Pause_button->isChecked();
   if (seq && !ui->MIDI_GMGS_button->isChecked()) {
-    if (!paused) on_Pause_button_toggled(true);
       if (!ui->Play_button->isChecked()) connect_port();
       buf[0] = 0xF0;
       buf[1] = 0x7F;
@@ -796,26 +688,28 @@ void MIDI_PLAY::on_MIDI_Volume_Master_valueChanged(int val) {
       buf[6] = val;
       buf[7] = 0xF7;
       send_SysEx(buf, 8);
-    if (!paused) on_Pause_button_toggled(false);
   }
 }
 
 void MIDI_PLAY::on_MIDI_Tempo_Master_valueChanged(int val) {
-  int tempo;
-  bool paused = ui->Pause_button->isChecked();
-  if (seq && !ui->MIDI_GMGS_button->isChecked()) {
-    tempo = 60000000/val;
-    snd_seq_event_t ev;
-    snd_seq_ev_clear(&ev);
-    ev.data.queue.queue = queue;
-    ev.data.queue.param.value = tempo;
-    ev.type = SND_SEQ_EVENT_TEMPO;
-    snd_seq_ev_set_fixed(&ev);
-    snd_seq_ev_set_direct(&ev);
-    if (!paused) on_Pause_button_toggled(true);
-    snd_seq_event_output_direct(seq, &ev);
-    if (!paused) on_Pause_button_toggled(false);
-  }
+  // the slider is in BPM: held, that is the tempo; otherwise it sets how
+  // much faster or slower than written the song plays, through all its
+  // tempo changes
+  if (val < 1) return;
+  if (ui->MIDI_Tempo_Hold->isChecked())
+    tempo_override = 60000000/val;
+  else if (old_tempo > 0)
+    tempo_scale = static_cast<double>(val)/old_tempo;
+  if (seq) post_tempo();
+  show_tempo();
+}
+
+void MIDI_PLAY::on_MIDI_Tempo_Hold_toggled(bool checked) {
+  // hold the tempo shown, or go back to following the song at the scale
+  if (checked && ui->MIDI_Tempo_Master->value() > 0)
+    tempo_override = 60000000/ui->MIDI_Tempo_Master->value();
+  if (seq) post_tempo();
+  show_tempo();
 }
 
 void MIDI_PLAY::on_MIDI_Exit_button_clicked() {
@@ -832,9 +726,11 @@ void MIDI_PLAY::on_MIDI_GMGS_button_toggled(bool checked) {
 }
 
 void MIDI_PLAY::on_MIDI_Transpose_valueChanged(signed int val) {
-  // if timer is running, pause playback, change the key, and resume
-  bool paused=ui->Pause_button->isChecked();
-  if (!paused) on_Pause_button_toggled(true);
+  // the engine transposes notes as it sends them, playing or not; notes
+  // already sounding end at the pitch they started at
+  struct player_cmd cmd = command(player_cmd::TRANSPOSE);
+  cmd.transpose = val;
+  player->post(cmd);
   // change the Key Signature if one is displayed
   if (ui->MIDI_KeySig->text().size()) {
   ui->MIDI_KeySig->clear();
@@ -949,632 +845,73 @@ void MIDI_PLAY::on_MIDI_Transpose_valueChanged(signed int val) {
     } // end switch
   }   // end Major key
   }
-  if (!paused) on_Pause_button_toggled(false);
 }	// end on_MIDI_Transpose_valueChanged
 
-void MIDI_PLAY::on_MIDI_Volume_1_valueChanged(int val) {
-  char buf[3];
-  buf[0] = 0xb0+0;
-  buf[1] = 0x07;	// new Volume
-  buf[2] = val;
-  send_CC(buf,3);
-}
-void MIDI_PLAY::on_MIDI_Volume_2_valueChanged(int val) {
-  char buf[3];
-  buf[0] = 0xb0+1;
-  buf[1] = 0x07;	// new Volume
-  buf[2] = val;
-  send_CC(buf,3);
-}
-void MIDI_PLAY::on_MIDI_Volume_3_valueChanged(int val) {
-  char buf[3];
-  buf[0] = 0xb0+2;
-  buf[1] = 0x07;	// new Volume
-  buf[2] = val;
-  send_CC(buf,3);
-}
-void MIDI_PLAY::on_MIDI_Volume_4_valueChanged(int val) {
-  char buf[3];
-  buf[0] = 0xb0+3;
-  buf[1] = 0x07;	// new Volume
-  buf[2] = val;
-  send_CC(buf,3);
-}
-void MIDI_PLAY::on_MIDI_Volume_5_valueChanged(int val) {
-  char buf[3];
-  buf[0] = 0xb0+4;
-  buf[1] = 0x07;	// new Volume
-  buf[2] = val;
-  send_CC(buf,3);
-}
-void MIDI_PLAY::on_MIDI_Volume_6_valueChanged(int val) {
-  char buf[3];
-  buf[0] = 0xb0+5;
-  buf[1] = 0x07;	// new Volume
-  buf[2] = val;
-  send_CC(buf,3);
-}
-void MIDI_PLAY::on_MIDI_Volume_7_valueChanged(int val) {
-  char buf[3];
-  buf[0] = 0xb0+6;
-  buf[1] = 0x07;	// new Volume
-  buf[2] = val;
-  send_CC(buf,3);
-}
-void MIDI_PLAY::on_MIDI_Volume_8_valueChanged(int val) {
+void MIDI_PLAY::on_mixer_changed(int channel, int controller, int value) {
   char buf[3];
-  buf[0] = 0xb0+7;
-  buf[1] = 0x07;	// new Volume
-  buf[2] = val;
+  buf[0] = 0xb0+channel;
+  buf[1] = controller;	// 0x07 Volume, 0x0B Expression
+  buf[2] = value;
   send_CC(buf,3);
-}
-void MIDI_PLAY::on_MIDI_Volume_9_valueChanged(int val) {
-  char buf[3];
-  buf[0] = 0xb0+8;
-  buf[1] = 0x07;	// new Volume
-  buf[2] = val;
-  send_CC(buf,3);
-}
-void MIDI_PLAY::on_MIDI_Volume_10_valueChanged(int val) {
-  char buf[3];
-  buf[0] = 0xb0+9;
-  buf[1] = 0x07;	// new Volume
-  buf[2] = val;
-  send_CC(buf,3);
-}
-void MIDI_PLAY::on_MIDI_Volume_11_valueChanged(int val) {
-  char buf[3];
-  buf[0] = 0xb0+10;
-  buf[1] = 0x07;	// new Volume
-  buf[2] = val;
-  send_CC(buf,3);
-}
-void MIDI_PLAY::on_MIDI_Volume_12_valueChanged(int val) {
-  char buf[3];
-  buf[0] = 0xb0+11;
-  buf[1] = 0x07;	// new Volume
-  buf[2] = val;
-  send_CC(buf,3);
-}
-void MIDI_PLAY::on_MIDI_Volume_13_valueChanged(int val) {
-  char buf[3];
-  buf[0] = 0xb0+12;
-  buf[1] = 0x07;	// new Volume
-  buf[2] = val;
-  send_CC(buf,3);
-}
-void MIDI_PLAY::on_MIDI_Volume_14_valueChanged(int val) {
-  char buf[3];
-  buf[0] = 0xb0+13;
-  buf[1] = 0x07;	// new Volume
-  buf[2] = val;
-  send_CC(buf,3);
-}
-void MIDI_PLAY::on_MIDI_Volume_15_valueChanged(int val) {
-  char buf[3];
-  buf[0] = 0xb0+14;
-  buf[1] = 0x07;	// new Volume
-  buf[2] = val;
-  send_CC(buf,3);
-}
-void MIDI_PLAY::on_MIDI_Volume_16_valueChanged(int val) {
-  char buf[3];
-  buf[0] = 0xb0+15;
-  buf[1] = 0x07;	// new Volume
-  buf[2] = val;
-  send_CC(buf,3);
-}
-void MIDI_PLAY::on_MIDI_Expression_1_valueChanged(int val) {
-  char buf[3];
-  buf[0] = 0xb0+0;
-  buf[1] = 0x0B;	// new Volume
-  buf[2] = val;
-  send_CC(buf,3);
-}
-void MIDI_PLAY::on_MIDI_Expression_2_valueChanged(int val) {
-  char buf[3];
-  buf[0] = 0xb0+1;
-  buf[1] = 0x0B;	// new Volume
-  buf[2] = val;
-  send_CC(buf,3);
-}
-void MIDI_PLAY::on_MIDI_Expression_3_valueChanged(int val) {
-  char buf[3];
-  buf[0] = 0xb0+2;
-  buf[1] = 0x0B;	// new Volume
-  buf[2] = val;
-  send_CC(buf,3);
-}
-void MIDI_PLAY::on_MIDI_Expression_4_valueChanged(int val) {
-  char buf[3];
-  buf[0] = 0xb0+3;
-  buf[1] = 0x0B;	// new Volume
-  buf[2] = val;
-  send_CC(buf,3);
-}
-void MIDI_PLAY::on_MIDI_Expression_5_valueChanged(int val) {
-  char buf[3];
-  buf[0] = 0xb0+4;
-  buf[1] = 0x0B;	// new Volume
-  buf[2] = val;
-  send_CC(buf,3);
-}
-void MIDI_PLAY::on_MIDI_Expression_6_valueChanged(int val) {
-  char buf[3];
-  buf[0] = 0xb0+5;
-  buf[1] = 0x0B;	// new Volume
-  buf[2] = val;
-  send_CC(buf,3);
-}
-void MIDI_PLAY::on_MIDI_Expression_7_valueChanged(int val) {
-  char buf[3];
-  buf[0] = 0xb0+6;
-  buf[1] = 0x0B;	// new Volume
-  buf[2] = val;
-  send_CC(buf,3);
-}
-void MIDI_PLAY::on_MIDI_Expression_8_valueChanged(int val) {
-  char buf[3];
-  buf[0] = 0xb0+7;
-  buf[1] = 0x0B;	// new Volume
-  buf[2] = val;
-  send_CC(buf,3);
-}
-void MIDI_PLAY::on_MIDI_Expression_9_valueChanged(int val) {
-  char buf[3];
-  buf[0] = 0xb0+8;
-  buf[1] = 0x0B;	// new Volume
-  buf[2] = val;
-  send_CC(buf,3);
-}
-void MIDI_PLAY::on_MIDI_Expression_10_valueChanged(int val) {
-  char buf[3];
-  buf[0] = 0xb0+9;
-  buf[1] = 0x0B;	// new Volume
-  buf[2] = val;
-  send_CC(buf,3);
-}
-void MIDI_PLAY::on_MIDI_Expression_11_valueChanged(int val) {
-  char buf[3];
-  buf[0] = 0xb0+10;
-  buf[1] = 0x0B;	// new Volume
-  buf[2] = val;
-  send_CC(buf,3);
-}
-void MIDI_PLAY::on_MIDI_Expression_12_valueChanged(int val) {
-  char buf[3];
-  buf[0] = 0xb0+11;
-  buf[1] = 0x0B;	// new Volume
-  buf[2] = val;
-  send_CC(buf,3);
-}
-void MIDI_PLAY::on_MIDI_Expression_13_valueChanged(int val) {
-  char buf[3];
-  buf[0] = 0xb0+12;
-  buf[1] = 0x0B;	// new Volume
-  buf[2] = val;
-  send_CC(buf,3);
-}
-void MIDI_PLAY::on_MIDI_Expression_14_valueChanged(int val) {
-  char buf[3];
-  buf[0] = 0xb0+13;
-  buf[1] = 0x0B;	// new Volume
-  buf[2] = val;
-  send_CC(buf,3);
-}
-void MIDI_PLAY::on_MIDI_Expression_15_valueChanged(int val) {
-  char buf[3];
-  buf[0] = 0xb0+14;
-  buf[1] = 0x0B;	// new Volume
-  buf[2] = val;
-  send_CC(buf,3);
-}
-void MIDI_PLAY::on_MIDI_Expression_16_valueChanged(int val) {
-  char buf[3];
-  buf[0] = 0xb0+15;
-  buf[1] = 0x0B;	// new Volume
-  buf[2] = val;
-  send_CC(buf,3);
-}
+}   // end on_mixer_changed
 
 void MIDI_PLAY::tickDisplay() {
-    // set timestamp display
-    snd_seq_get_queue_status(seq, queue, status);    
-    unsigned int current_tick = snd_seq_queue_status_get_tick_time(status);
+    // the engine has moved on: it posts this once a frame at most while
+    // the song plays, and once more where it stops. Reading the position
+    // lets it post the next one
+    struct player_position at;
+    player->position(at);
+    if (!ui->Play_button->isChecked())
+        return;
+    unsigned int current_tick = at.tick;
     // set slider
     ui->progressBar->blockSignals(true);
-    ui->progressBar->setValue(current_tick);
+    ui->progressBar->setValue(static_cast<int>(tempo_map.usec_at(current_tick)/1000));
     ui->progressBar->blockSignals(false);
     // set time lable
-    double new_seconds = static_cast<double>(current_tick)/all_events.back().tick;
-    new_seconds *= song_length_seconds;
-    ui->MIDI_time_display->setText(QString::number(static_cast<int>(new_seconds)/60).rightJustified(2,'0')+
-      ":"+QString::number(static_cast<int>(new_seconds)%60).rightJustified(2,'0'));
+    double new_seconds = play_seconds(current_tick);
+    bool song_end = current_tick >= all_events.last_tick();
+    if (streaming) {
+        // no length to go by: show the queue's own clock, and the song is
+        // over when the engine has seen the queue play its last event
+        new_seconds = at.seconds;
+        song_end = at.finished;
+    }
+    // the label and its rates change once a second
+    if (static_cast<int>(new_seconds) != shown_seconds) {
+        shown_seconds = static_cast<int>(new_seconds);
+        ui->MIDI_time_display->setText(QString::number(shown_seconds/60).rightJustified(2,'0')+
+          ":"+QString::number(shown_seconds%60).rightJustified(2,'0'));
+        struct player_stats rates;
+        struct output_stats out;
+        player->stats(rates);
+        player->output_stats(out);
+        ui->MIDI_time_display->setToolTip(QString("%1 events/s, sent at up to %2 events/s\n"
+            "%3: %4 events/s, latency %5 us (worst %6 us)")
+            .arg(rates.per_second) .arg(rates.dispatch_rate)
+            .arg(out.backend) .arg(out.per_second) .arg(out.latency_usec) .arg(out.max_latency_usec));
+    }
     // end of song?
-    if (current_tick >= all_events.back().tick) {
+    if (song_end) {
         sleep(1);
         ui->Play_button->setChecked(false);
 	return;
     }
-    // set Tempo display
-    static int nt;
-    for (std::vector<tempo_chg>::iterator tc=tempoTable.begin(); tc!=tempoTable.end(); ++tc)  {
-      if (tc->tick <= current_tick) {
-	nt=tc->new_tempo;
-	continue;
-      } else break;
-    }
+    // set Tempo display, from the piece of the tempo map it was at last frame
+    int nt = 60000000 / tempo_map.tempo_at(current_tick, tempo_cursor);
     if (nt != old_tempo) {
-      ui->MIDI_Tempo_Master->blockSignals(true);
-      ui->MIDI_Tempo_Master->setValue(nt);
-      ui->MIDI_Tempo_Master->blockSignals(false);
-      ui->MIDI_Tempo_Master_display->display(nt);
       old_tempo = nt;
+      show_tempo();
     }
-    // set Volume, Expression markers 
-    while (all_events[event_num].tick<current_tick) {
-      if (all_events[event_num].type==SND_SEQ_EVENT_CONTROLLER) {
-	if (all_events[event_num].data.d[1]==7) {		// Volume changed using CC "Bx 07 nn"
-	  switch(all_events[event_num].data.d[0] & 0x0F) {
-	    case 0:
-		ui->MIDI_Volume_1->blockSignals(true);
-		ui->MIDI_Volume_1->setValue(all_events[event_num].data.d[2]);
-		ui->MIDI_Volume_1->blockSignals(false);
-	        if (ui->MIDI_VolDisp_1->value()) ui->MIDI_VolDisp_1->setValue((ui->MIDI_VolDisp_1->value() + 
-		  ui->MIDI_Expression_1->value() + ui->MIDI_Volume_1->value()) / (ui->MIDI_Expression_1->value()?3:2));
-		break;
-	    case 1:
-		ui->MIDI_Volume_2->blockSignals(true);
-		ui->MIDI_Volume_2->setValue(all_events[event_num].data.d[2]);
-		ui->MIDI_Volume_2->blockSignals(false);
-	        if (ui->MIDI_VolDisp_2->value()) ui->MIDI_VolDisp_2->setValue((ui->MIDI_VolDisp_2->value() + 
-		  ui->MIDI_Expression_2->value() + ui->MIDI_Volume_2->value()) / (ui->MIDI_Expression_2->value()?3:2));
-		break;
-	    case 2:
-		ui->MIDI_Volume_3->blockSignals(true);
-		ui->MIDI_Volume_3->setValue(all_events[event_num].data.d[2]);
-		ui->MIDI_Volume_3->blockSignals(false);
-	        if (ui->MIDI_VolDisp_3->value()) ui->MIDI_VolDisp_3->setValue((ui->MIDI_VolDisp_3->value() + 
-		  ui->MIDI_Expression_3->value() + ui->MIDI_Volume_3->value()) / (ui->MIDI_Expression_3->value()?3:2));
-		break;
-	    case 3:
-		ui->MIDI_Volume_4->blockSignals(true);
-		ui->MIDI_Volume_4->setValue(all_events[event_num].data.d[2]);
-		ui->MIDI_Volume_4->blockSignals(false);
-	        if (ui->MIDI_VolDisp_4->value()) ui->MIDI_VolDisp_4->setValue((ui->MIDI_VolDisp_4->value() + 
-		  ui->MIDI_Expression_4->value() + ui->MIDI_Volume_4->value()) / (ui->MIDI_Expression_4->value()?3:2));
-		break;
-	    case 4:
-		ui->MIDI_Volume_5->blockSignals(true);
-		ui->MIDI_Volume_5->setValue(all_events[event_num].data.d[2]);
-		ui->MIDI_Volume_5->blockSignals(false);
-	        if (ui->MIDI_VolDisp_5->value()) ui->MIDI_VolDisp_5->setValue((ui->MIDI_VolDisp_5->value() + 
-		  ui->MIDI_Expression_5->value() + ui->MIDI_Volume_5->value()) / (ui->MIDI_Expression_5->value()?3:2));
-		break;
-	    case 5:
-		ui->MIDI_Volume_6->blockSignals(true);
-		ui->MIDI_Volume_6->setValue(all_events[event_num].data.d[2]);
-		ui->MIDI_Volume_6->blockSignals(false);
-	        if (ui->MIDI_VolDisp_6->value()) ui->MIDI_VolDisp_6->setValue((ui->MIDI_VolDisp_6->value() + 
-		  ui->MIDI_Expression_6->value() + ui->MIDI_Volume_6->value()) / (ui->MIDI_Expression_6->value()?3:2));
-		break;
-	    case 6:
-		ui->MIDI_Volume_7->blockSignals(true);
-		ui->MIDI_Volume_7->setValue(all_events[event_num].data.d[2]);
-		ui->MIDI_Volume_7->blockSignals(false);
-	        if (ui->MIDI_VolDisp_7->value()) ui->MIDI_VolDisp_7->setValue((ui->MIDI_VolDisp_7->value() + 
-		  ui->MIDI_Expression_7->value() + ui->MIDI_Volume_7->value()) / (ui->MIDI_Expression_7->value()?3:2));
-		break;
-	    case 7:
-		ui->MIDI_Volume_8->blockSignals(true);
-		ui->MIDI_Volume_8->setValue(all_events[event_num].data.d[2]);
-		ui->MIDI_Volume_8->blockSignals(false);
-	        if (ui->MIDI_VolDisp_8->value()) ui->MIDI_VolDisp_8->setValue((ui->MIDI_VolDisp_8->value() + 
-		  ui->MIDI_Expression_8->value() + ui->MIDI_Volume_8->value()) / (ui->MIDI_Expression_8->value()?3:2));
-		break;
-	    case 8:
-		ui->MIDI_Volume_9->blockSignals(true);
-		ui->MIDI_Volume_9->setValue(all_events[event_num].data.d[2]);
-		ui->MIDI_Volume_9->blockSignals(false);
-	        if (ui->MIDI_VolDisp_9->value()) ui->MIDI_VolDisp_9->setValue((ui->MIDI_VolDisp_9->value() + 
-		  ui->MIDI_Expression_9->value() + ui->MIDI_Volume_9->value()) / (ui->MIDI_Expression_9->value()?3:2));
-		break;
-	    case 9:
-		ui->MIDI_Volume_10->blockSignals(true);
-		ui->MIDI_Volume_10->setValue(all_events[event_num].data.d[2]);
-		ui->MIDI_Volume_10->blockSignals(false);
-	        if (ui->MIDI_VolDisp_10->value()) ui->MIDI_VolDisp_10->setValue((ui->MIDI_VolDisp_10->value() + 
-		  ui->MIDI_Expression_10->value() + ui->MIDI_Volume_10->value()) / (ui->MIDI_Expression_10->value()?3:2));
-		break;
-	    case 10:
-		ui->MIDI_Volume_11->blockSignals(true);
-		ui->MIDI_Volume_11->setValue(all_events[event_num].data.d[2]);
-		ui->MIDI_Volume_11->blockSignals(false);
-	        if (ui->MIDI_VolDisp_11->value()) ui->MIDI_VolDisp_11->setValue((ui->MIDI_VolDisp_11->value() + 
-		  ui->MIDI_Expression_11->value() + ui->MIDI_Volume_11->value()) / (ui->MIDI_Expression_11->value()?3:2));
-		break;
-	    case 11:
-		ui->MIDI_Volume_12->blockSignals(true);
-		ui->MIDI_Volume_12->setValue(all_events[event_num].data.d[2]);
-		ui->MIDI_Volume_12->blockSignals(false);
-	        if (ui->MIDI_VolDisp_12->value()) ui->MIDI_VolDisp_12->setValue((ui->MIDI_VolDisp_12->value() + 
-		  ui->MIDI_Expression_12->value() + ui->MIDI_Volume_12->value()) / (ui->MIDI_Expression_12->value()?3:2));
-		break;
-	    case 12:
-		ui->MIDI_Volume_13->blockSignals(true);
-		ui->MIDI_Volume_13->setValue(all_events[event_num].data.d[2]);
-		ui->MIDI_Volume_13->blockSignals(false);
-	        if (ui->MIDI_VolDisp_13->value()) ui->MIDI_VolDisp_13->setValue((ui->MIDI_VolDisp_13->value() + 
-		  ui->MIDI_Expression_13->value() + ui->MIDI_Volume_13->value()) / (ui->MIDI_Expression_13->value()?3:2));
-		break;
-	    case 13:
-		ui->MIDI_Volume_14->blockSignals(true);
-		ui->MIDI_Volume_14->setValue(all_events[event_num].data.d[2]);
-		ui->MIDI_Volume_14->blockSignals(false);
-	        if (ui->MIDI_VolDisp_14->value()) ui->MIDI_VolDisp_14->setValue((ui->MIDI_VolDisp_14->value() + 
-		  ui->MIDI_Expression_14->value() + ui->MIDI_Volume_14->value()) / (ui->MIDI_Expression_14->value()?3:2));
-		break;
-	    case 14:
-		ui->MIDI_Volume_15->blockSignals(true);
-		ui->MIDI_Volume_15->setValue(all_events[event_num].data.d[2]);
-		ui->MIDI_Volume_15->blockSignals(false);
-	        if (ui->MIDI_VolDisp_15->value()) ui->MIDI_VolDisp_15->setValue((ui->MIDI_VolDisp_15->value() + 
-		  ui->MIDI_Expression_15->value() + ui->MIDI_Volume_15->value()) / (ui->MIDI_Expression_15->value()?3:2));
-		break;
-	    case 15:
-		ui->MIDI_Volume_16->blockSignals(true);
-		ui->MIDI_Volume_16->setValue(all_events[event_num].data.d[2]);
-		ui->MIDI_Volume_16->blockSignals(false);
-	        if (ui->MIDI_VolDisp_16->value()) ui->MIDI_VolDisp_16->setValue((ui->MIDI_VolDisp_16->value() + 
-		  ui->MIDI_Expression_16->value() + ui->MIDI_Volume_16->value()) / (ui->MIDI_Expression_16->value()?3:2));
-		break;
-	    default:
-		break;
-	    } // end SWITCH
-	   } // end IF VOL
-	   else if (all_events[event_num].data.d[1]==0x0B) {	// Expr change using CC "Bx 0B nn"
-	    switch(all_events[event_num].data.d[0] & 0x0F) {
-	      case 0:
-		ui->MIDI_Expression_1->blockSignals(true);
-		ui->MIDI_Expression_1->setValue(all_events[event_num].data.d[2]);
-		ui->MIDI_Expression_1->blockSignals(false);
-	        if (ui->MIDI_VolDisp_1->value()) ui->MIDI_VolDisp_1->setValue((ui->MIDI_VolDisp_1->value() + 
-		  ui->MIDI_Expression_1->value() + ui->MIDI_Volume_1->value()) / (ui->MIDI_Volume_1->value()?3:2));
-		break;
-	      case 1:
-		ui->MIDI_Expression_2->blockSignals(true);
-		ui->MIDI_Expression_2->setValue(all_events[event_num].data.d[2]);
-		ui->MIDI_Expression_2->blockSignals(false);
-	        if (ui->MIDI_VolDisp_2->value()) ui->MIDI_VolDisp_2->setValue((ui->MIDI_VolDisp_2->value() + 
-		  ui->MIDI_Expression_2->value() + ui->MIDI_Volume_2->value()) / (ui->MIDI_Volume_2->value()?3:2));
-		break;
-	      case 2:
-		ui->MIDI_Expression_3->blockSignals(true);
-		ui->MIDI_Expression_3->setValue(all_events[event_num].data.d[2]);
-		ui->MIDI_Expression_3->blockSignals(false);
-	        if (ui->MIDI_VolDisp_3->value()) ui->MIDI_VolDisp_3->setValue((ui->MIDI_VolDisp_3->value() + 
-		  ui->MIDI_Expression_3->value() + ui->MIDI_Volume_3->value()) / (ui->MIDI_Volume_3->value()?3:2));
-		break;
-	      case 3:
-		ui->MIDI_Expression_4->blockSignals(true);
-		ui->MIDI_Expression_4->setValue(all_events[event_num].data.d[2]);
-		ui->MIDI_Expression_4->blockSignals(false);
-	        if (ui->MIDI_VolDisp_4->value()) ui->MIDI_VolDisp_4->setValue((ui->MIDI_VolDisp_4->value() + 
-		  ui->MIDI_Expression_4->value() + ui->MIDI_Volume_4->value()) / (ui->MIDI_Volume_4->value()?3:2));
-		break;
-	      case 4:
-		ui->MIDI_Expression_5->blockSignals(true);
-		ui->MIDI_Expression_5->setValue(all_events[event_num].data.d[2]);
-		ui->MIDI_Expression_5->blockSignals(false);
-	        if (ui->MIDI_VolDisp_5->value()) ui->MIDI_VolDisp_5->setValue((ui->MIDI_VolDisp_5->value() + 
-		  ui->MIDI_Expression_5->value() + ui->MIDI_Volume_5->value()) / (ui->MIDI_Volume_5->value()?3:2));
-		break;
-	      case 5:
-		ui->MIDI_Expression_6->blockSignals(true);
-		ui->MIDI_Expression_6->setValue(all_events[event_num].data.d[2]);
-		ui->MIDI_Expression_6->blockSignals(false);
-	        if (ui->MIDI_VolDisp_6->value()) ui->MIDI_VolDisp_6->setValue((ui->MIDI_VolDisp_6->value() + 
-		  ui->MIDI_Expression_6->value() + ui->MIDI_Volume_6->value()) / (ui->MIDI_Volume_6->value()?3:2));
-		break;
-	      case 6:
-		ui->MIDI_Expression_7->blockSignals(true);
-		ui->MIDI_Expression_7->setValue(all_events[event_num].data.d[2]);
-		ui->MIDI_Expression_7->blockSignals(false);
-	        if (ui->MIDI_VolDisp_7->value()) ui->MIDI_VolDisp_7->setValue((ui->MIDI_VolDisp_7->value() + 
-		  ui->MIDI_Expression_7->value() + ui->MIDI_Volume_7->value()) / (ui->MIDI_Volume_7->value()?3:2));
-		break;
-	      case 7:
-		ui->MIDI_Expression_8->blockSignals(true);
-		ui->MIDI_Expression_8->setValue(all_events[event_num].data.d[2]);
-		ui->MIDI_Expression_8->blockSignals(false);
-	        if (ui->MIDI_VolDisp_8->value()) ui->MIDI_VolDisp_8->setValue((ui->MIDI_VolDisp_8->value() + 
-		  ui->MIDI_Expression_8->value() + ui->MIDI_Volume_8->value()) / (ui->MIDI_Volume_8->value()?3:2));
-		break;
-	      case 8:
-		ui->MIDI_Expression_9->blockSignals(true);
-		ui->MIDI_Expression_9->setValue(all_events[event_num].data.d[2]);
-		ui->MIDI_Expression_9->blockSignals(false);
-	        if (ui->MIDI_VolDisp_9->value()) ui->MIDI_VolDisp_9->setValue((ui->MIDI_VolDisp_9->value() + 
-		  ui->MIDI_Expression_9->value() + ui->MIDI_Volume_9->value()) / (ui->MIDI_Volume_9->value()?3:2));
-		break;
-	      case 9:
-		ui->MIDI_Expression_10->blockSignals(true);
-		ui->MIDI_Expression_10->setValue(all_events[event_num].data.d[2]);
-		ui->MIDI_Expression_10->blockSignals(false);
-	        if (ui->MIDI_VolDisp_10->value()) ui->MIDI_VolDisp_10->setValue((ui->MIDI_VolDisp_10->value() + 
-		  ui->MIDI_Expression_10->value() + ui->MIDI_Volume_10->value()) / (ui->MIDI_Volume_10->value()?3:2));
-		break;
-	      case 10:
-		ui->MIDI_Expression_11->blockSignals(true);
-		ui->MIDI_Expression_11->setValue(all_events[event_num].data.d[2]);
-		ui->MIDI_Expression_11->blockSignals(false);
-	        if (ui->MIDI_VolDisp_11->value()) ui->MIDI_VolDisp_11->setValue((ui->MIDI_VolDisp_11->value() + 
-		  ui->MIDI_Expression_11->value() + ui->MIDI_Volume_11->value()) / (ui->MIDI_Volume_11->value()?3:2));
-		break;
-	      case 11:
-		ui->MIDI_Expression_12->blockSignals(true);
-		ui->MIDI_Expression_12->setValue(all_events[event_num].data.d[2]);
-		ui->MIDI_Expression_12->blockSignals(false);
-	        if (ui->MIDI_VolDisp_12->value()) ui->MIDI_VolDisp_12->setValue((ui->MIDI_VolDisp_12->value() + 
-		  ui->MIDI_Expression_12->value() + ui->MIDI_Volume_12->value()) / (ui->MIDI_Volume_12->value()?3:2));
-		break;
-	      case 12:
-		ui->MIDI_Expression_13->blockSignals(true);
-		ui->MIDI_Expression_13->setValue(all_events[event_num].data.d[2]);
-		ui->MIDI_Expression_13->blockSignals(false);
-	        if (ui->MIDI_VolDisp_13->value()) ui->MIDI_VolDisp_13->setValue((ui->MIDI_VolDisp_13->value() + 
-		  ui->MIDI_Expression_13->value() + ui->MIDI_Volume_13->value()) / (ui->MIDI_Volume_13->value()?3:2));
-		break;
-	      case 13:
-		ui->MIDI_Expression_14->blockSignals(true);
-		ui->MIDI_Expression_14->setValue(all_events[event_num].data.d[2]);
-		ui->MIDI_Expression_14->blockSignals(false);
-	        if (ui->MIDI_VolDisp_14->value()) ui->MIDI_VolDisp_14->setValue((ui->MIDI_VolDisp_14->value() + 
-		  ui->MIDI_Expression_14->value() + ui->MIDI_Volume_14->value()) / (ui->MIDI_Volume_14->value()?3:2));
-		break;
-	      case 14:
-		ui->MIDI_Expression_15->blockSignals(true);
-		ui->MIDI_Expression_15->setValue(all_events[event_num].data.d[2]);
-		ui->MIDI_Expression_15->blockSignals(false);
-	        if (ui->MIDI_VolDisp_15->value()) ui->MIDI_VolDisp_15->setValue((ui->MIDI_VolDisp_15->value() + 
-		  ui->MIDI_Expression_15->value() + ui->MIDI_Volume_15->value()) / (ui->MIDI_Volume_15->value()?3:2));
-		break;
-	      case 15:
-		ui->MIDI_Expression_16->blockSignals(true);
-		ui->MIDI_Expression_16->setValue(all_events[event_num].data.d[2]);
-		ui->MIDI_Expression_16->blockSignals(false);
-	        if (ui->MIDI_VolDisp_16->value()) ui->MIDI_VolDisp_16->setValue((ui->MIDI_VolDisp_16->value() + 
-		  ui->MIDI_Expression_16->value() + ui->MIDI_Volume_16->value()) / (ui->MIDI_Volume_16->value()?3:2));
-		break;
-	      default:
-		break;
-	    } // end SWITCH
-	   } // end IF EXPR	 
-	} // end IF CC
-	
-	// scan for Note On, set VolumeDisp to average of VELOCITY+VOLUME+EXPRESSION
-	if (all_events[event_num].type==SND_SEQ_EVENT_NOTEON) {
-	  switch(all_events[event_num].data.d[0] & 0x0F) {	// switch by channel
-	    case 0:
-	      ui->MIDI_VolDisp_1->setValue((all_events[event_num].data.d[2] + ui->MIDI_Expression_1->value() + 
-	        ui->MIDI_Volume_1->value()) / (1+(ui->MIDI_Expression_1->value()?1:0)+(ui->MIDI_Volume_1->value()?1:0)));
-	      break;
-	    case 1:
-	      ui->MIDI_VolDisp_2->setValue((all_events[event_num].data.d[2] + ui->MIDI_Expression_2->value() + 
-	        ui->MIDI_Volume_2->value()) / (1+(ui->MIDI_Expression_2->value()?1:0)+(ui->MIDI_Volume_2->value()?1:0)));
-	      break;
-	    case 2:
-	      ui->MIDI_VolDisp_3->setValue((all_events[event_num].data.d[2] + ui->MIDI_Expression_3->value() + 
-	        ui->MIDI_Volume_3->value()) / (1+(ui->MIDI_Expression_3->value()?1:0)+(ui->MIDI_Volume_3->value()?1:0)));
-	      break;
-	    case 3:
-	      ui->MIDI_VolDisp_4->setValue((all_events[event_num].data.d[2] + ui->MIDI_Expression_4->value() + 
-	        ui->MIDI_Volume_4->value()) / (1+(ui->MIDI_Expression_4->value()?1:0)+(ui->MIDI_Volume_4->value()?1:0)));
-	      break;
-	    case 4:
-	      ui->MIDI_VolDisp_5->setValue((all_events[event_num].data.d[2] + ui->MIDI_Expression_5->value() + 
-	        ui->MIDI_Volume_5->value()) / (1+(ui->MIDI_Expression_5->value()?1:0)+(ui->MIDI_Volume_5->value()?1:0)));
-	      break;
-	    case 5:
-	      ui->MIDI_VolDisp_6->setValue((all_events[event_num].data.d[2] + ui->MIDI_Expression_6->value() + 
-	        ui->MIDI_Volume_6->value()) / (1+(ui->MIDI_Expression_6->value()?1:0)+(ui->MIDI_Volume_6->value()?1:0)));
-	      break;
-	    case 6:
-	      ui->MIDI_VolDisp_7->setValue((all_events[event_num].data.d[2] + ui->MIDI_Expression_7->value() + 
-	        ui->MIDI_Volume_7->value()) / (1+(ui->MIDI_Expression_7->value()?1:0)+(ui->MIDI_Volume_7->value()?1:0)));
-	      break;
-	    case 7:
-	      ui->MIDI_VolDisp_8->setValue((all_events[event_num].data.d[2] + ui->MIDI_Expression_8->value() + 
-	      ui->MIDI_Volume_8->value()) / (1+(ui->MIDI_Expression_8->value()?1:0)+(ui->MIDI_Volume_8->value()?1:0)));
-	      break;
-	    case 8:
-	      ui->MIDI_VolDisp_9->setValue((all_events[event_num].data.d[2] + ui->MIDI_Expression_9->value() + 
-	      ui->MIDI_Volume_9->value()) / (1+(ui->MIDI_Expression_9->value()?1:0)+(ui->MIDI_Volume_9->value()?1:0)));
-	      break;
-	    case 9:
-	      ui->MIDI_VolDisp_10->setValue((all_events[event_num].data.d[2] + ui->MIDI_Expression_10->value() + 
-	      ui->MIDI_Volume_10->value()) / (1+(ui->MIDI_Expression_10->value()?1:0)+(ui->MIDI_Volume_10->value()?1:0)));
-	      break;
-	    case 10:
-	      ui->MIDI_VolDisp_11->setValue((all_events[event_num].data.d[2] + ui->MIDI_Expression_11->value() + 
-	      ui->MIDI_Volume_11->value()) / (1+(ui->MIDI_Expression_11->value()?1:0)+(ui->MIDI_Volume_11->value()?1:0)));
-	      break;
-	    case 11:
-	      ui->MIDI_VolDisp_12->setValue((all_events[event_num].data.d[2] + ui->MIDI_Expression_12->value() + 
-	      ui->MIDI_Volume_12->value()) / (1+(ui->MIDI_Expression_12->value()?1:0)+(ui->MIDI_Volume_12->value()?1:0)));
-	      break;
-	    case 12:
-	      ui->MIDI_VolDisp_13->setValue((all_events[event_num].data.d[2] + ui->MIDI_Expression_13->value() + 
-	      ui->MIDI_Volume_13->value()) / (1+(ui->MIDI_Expression_13->value()?1:0)+(ui->MIDI_Volume_13->value()?1:0)));
-	      break;
-	    case 13:
-	      ui->MIDI_VolDisp_14->setValue((all_events[event_num].data.d[2] + ui->MIDI_Expression_14->value() + 
-	      ui->MIDI_Volume_14->value()) / (1+(ui->MIDI_Expression_14->value()?1:0)+(ui->MIDI_Volume_14->value()?1:0)));
-	      break;
-	    case 14:
-	      ui->MIDI_VolDisp_15->setValue((all_events[event_num].data.d[2] + ui->MIDI_Expression_15->value() + 
-	      ui->MIDI_Volume_15->value()) / (1+(ui->MIDI_Expression_15->value()?1:0)+(ui->MIDI_Volume_15->value()?1:0)));
-	      break;
-	    case 15:
-	      ui->MIDI_VolDisp_16->setValue((all_events[event_num].data.d[2] + ui->MIDI_Expression_16->value() + 
-	      ui->MIDI_Volume_16->value()) / (1+(ui->MIDI_Expression_16->value()?1:0)+(ui->MIDI_Volume_16->value()?1:0)));
-	      break;
-	  } // end switch NOTEON
-	} // end IF NOTEON
-	// scan for Note Off, reset volume disp
-	else if (all_events[event_num].type==SND_SEQ_EVENT_NOTEOFF) {
-	  switch(all_events[event_num].data.d[0] & 0x0F) {
-	    case 0:
-	      ui->MIDI_VolDisp_1->setValue(0);
-	      break;
-	    case 1:
-	      ui->MIDI_VolDisp_2->setValue(0);
-	      break;
-	    case 2:
-	      ui->MIDI_VolDisp_3->setValue(0);
-	      break;
-	    case 3:
-	      ui->MIDI_VolDisp_4->setValue(0);
-	      break;
-	    case 4:
-	      ui->MIDI_VolDisp_5->setValue(0);
-	      break;
-	    case 5:
-	      ui->MIDI_VolDisp_6->setValue(0);
-	      break;
-	    case 6:
-	      ui->MIDI_VolDisp_7->setValue(0);
-	      break;
-	    case 7:
-	      ui->MIDI_VolDisp_8->setValue(0);
-	      break;
-	    case 8:
-	      ui->MIDI_VolDisp_9->setValue(0);
-	      break;
-	    case 9:
-	      ui->MIDI_VolDisp_10->setValue(0);
-	      break;
-	    case 10:
-	      ui->MIDI_VolDisp_11->setValue(0);
-	      break;
-	    case 11:
-	      ui->MIDI_VolDisp_12->setValue(0);
-	      break;
-	    case 12:
-	      ui->MIDI_VolDisp_13->setValue(0);
-	      break;
-	    case 13:
-	      ui->MIDI_VolDisp_14->setValue(0);
-	      break;
-	    case 14:
-	      ui->MIDI_VolDisp_15->setValue(0);
-	      break;
-	    case 15:
-	      ui->MIDI_VolDisp_16->setValue(0);
-	      break;
-	  } // end switch NOTEOFF
-	} // end IF NOTEOFF
-      event_num++;
-    }	// end WHILE all_events
+    // set Volume, Expression markers and the level meters: one frame of
+    // the song's meter timeline, right at once after a seek. A slider is
+    // moved only when the song changes it, so one set by hand stays until
+    // the song's next CC 7 or 11, as the synth has it
+    // the loader builds the timeline after the song is playable, there is
+    // none to read until it is done
+    const struct meter_frame *frame = loader ? 0 : meters.at(tempo_map.usec_at(current_tick), meter_cursor);
+    if (frame)
+        ui->mixer->set_frame(*frame, shown_frame);
+    shown_frame = frame;
 }   // end tickDisplay
 
@@ -3,9 +3,16 @@
 
 #include <QtGui>
 #include <QMainWindow>
-#include <QTimer>
 #include <alsa/asoundlib.h>
 #include <vector>
+#include "event_store.h"
+#include "smf_decoder.h"
+#include "song_cache.h"
+#include "song_loader.h"
+#include "player.h"
+#include "chase.h"
+#include "tempo_map.h"
+#include "meters.h"
 
 namespace Ui {
     class MIDI_PLAY;
@@ -25,66 +32,52 @@ protected:
 private:
     Ui::MIDI_PLAY *ui;
 
-    struct event {
-        struct event *next;		// linked list
-        unsigned char type;		// SND_SEQ_EVENT_xxx
-        unsigned char port;		// port index
-        unsigned int tick;
-        union {
-            unsigned char d[3];	// channel and data bytes
-            int tempo;
-            unsigned int length;	// length of sysex data
-        } data;
-        std::vector<unsigned char> sysex;
-    };  // end struct event definition
-
-    struct track {
-        struct event *first_event;	// list of all events in this track
-        int end_tick;			// length of this track
-        struct event *current_event;	// used while loading and playing
-    };  // end struct track definition
-
-    struct tempo_chg {
-      unsigned int tick;
-      int new_tempo;
-    };
-
     static snd_seq_t *seq;
-    static snd_seq_addr_t *ports;
+    static snd_seq_addr_t *ports;       // the PortBox port, then any from MIDI_PLAY_PORTS
+    static int port_count;
     static snd_seq_queue_tempo_t *queue_tempo;
     static double song_length_seconds;
     static bool minor_key;
     static int sf;  // sharps/flats
     static double BPM,PPQ;
-    static unsigned int event_num;
 
     int queue;
-    std::vector<struct event> all_events;
-    std::vector<struct tempo_chg> tempoTable;
-    QTimer *timer;
+    bool streaming;                     // song is decoded while it plays, all_events is empty
+    SMF_DECODER decoder;                // holds the file image while a stream plays
+    SONG_LOADER *loader;                // set while a song is loading
+    PLAYER *player;                     // playback engine, sends everything to the sequencer
+    unsigned char route[SONG_PORTS][16];    // MIDI_PLAY_ROUTE by song port and channel, 0xff if not routed
+    double tempo_scale;                 // Tempo slider over the song's own tempo
+    int tempo_override;                 // usec per quarter while Hold is checked
+    int shown_seconds;                  // in the time label, -1 to set it on the next frame
+    unsigned int tempo_cursor;          // tempo map piece the display was at last frame
+    unsigned int meter_cursor;          // and meter timeline frame
+    const struct meter_frame *shown_frame;  // that frame, 0 to set every slider from the next one
+    EVENT_STORE all_events;
+    CHASE_TABLE chase;                  // channel state through the song, for starting part way
+    TEMPO_MAP tempo_map;                // where the song's ticks fall in time
+    METER_TIMELINE meters;              // what the mixer shows through the song
+    struct song_summary song;
     inline void check_snd(const char *, int);
-    inline int read_id(void);
-    inline int read_byte(void);
-    inline void skip(int);
-    static bool tick_comp(const struct event& e1, const struct event& e2);
-    int read_int(int);
-    int read_var(void);
-    int read_32_le(void);
-    int read_smf(char *);
-    int read_riff(char *);
-    int read_track(int, char *);
-    void play_midi(unsigned int);
-    void send_CC(char *, int);
+    void show_keysig();
+    int apply_song();
+    struct player_cmd command(int op);
+    void send_CC(char *, int, int to=-1);
     void send_SysEx(char *, int);
     void init_seq();
     void close_seq();
     void connect_port();
     void disconnect_port();
-    int parseFile(char *);
+    int parse_ports();
+    void getRoutes();
+    int finishLoad();
     void getPorts(QString buf="");
     void getRawDev(QString buf="");
-    void startPlayer(int startTick=0);
+    void startPlayer(int startTick=0, bool resume=false);
     void stopPlayer();
+    void post_tempo();
+    void show_tempo();
+    double play_seconds(unsigned int tick);
 
 private slots:
     void on_progressBar_sliderReleased();
@@ -95,44 +88,18 @@ private slots:
     void on_Play_button_toggled(bool);
     void on_Panic_button_clicked();
     void on_Open_button_clicked();
+    void loadProgress(int);
+    void songPlayable();
+    void songLoaded();
+    void playerFailed(QString);
     void on_MIDI_Tempo_Master_valueChanged(int);
+    void on_MIDI_Tempo_Hold_toggled(bool);
     void on_MIDI_Volume_Master_valueChanged(int);
     void on_MIDI_Exit_button_clicked();
     void on_MIDI_GMGS_button_toggled(bool);
     void on_MIDI_Transpose_valueChanged(int);
     void tickDisplay();
-    void on_MIDI_Volume_1_valueChanged(int);
-    void on_MIDI_Volume_2_valueChanged(int);
-    void on_MIDI_Volume_3_valueChanged(int);
-    void on_MIDI_Volume_4_valueChanged(int);
-    void on_MIDI_Volume_5_valueChanged(int);
-    void on_MIDI_Volume_6_valueChanged(int);
-    void on_MIDI_Volume_7_valueChanged(int);
-    void on_MIDI_Volume_8_valueChanged(int);
-    void on_MIDI_Volume_9_valueChanged(int);
-    void on_MIDI_Volume_10_valueChanged(int);
-    void on_MIDI_Volume_11_valueChanged(int);
-    void on_MIDI_Volume_12_valueChanged(int);
-    void on_MIDI_Volume_13_valueChanged(int);
-    void on_MIDI_Volume_14_valueChanged(int);
-    void on_MIDI_Volume_15_valueChanged(int);
-    void on_MIDI_Volume_16_valueChanged(int);
-    void on_MIDI_Expression_1_valueChanged(int);
-    void on_MIDI_Expression_2_valueChanged(int);
-    void on_MIDI_Expression_3_valueChanged(int);
-    void on_MIDI_Expression_4_valueChanged(int);
-    void on_MIDI_Expression_5_valueChanged(int);
-    void on_MIDI_Expression_6_valueChanged(int);
-    void on_MIDI_Expression_7_valueChanged(int);
-    void on_MIDI_Expression_8_valueChanged(int);
-    void on_MIDI_Expression_9_valueChanged(int);
-    void on_MIDI_Expression_10_valueChanged(int);
-    void on_MIDI_Expression_11_valueChanged(int);
-    void on_MIDI_Expression_12_valueChanged(int);
-    void on_MIDI_Expression_13_valueChanged(int);
-    void on_MIDI_Expression_14_valueChanged(int);
-    void on_MIDI_Expression_15_valueChanged(int);
-    void on_MIDI_Expression_16_valueChanged(int);
+    void on_mixer_changed(int, int, int);
 };
 
 #endif // MIDI_PLAY_H
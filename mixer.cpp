@@ -0,0 +1,235 @@
+// mixer.cpp -- part of MIDI_PLAY
+// the channel strips, see mixer.h. Strips are laid out two rows of eight,
+// channels 1-8 above 9-16, each one as the designer's frames were: Vol and
+// Exp sliders side by side with the meter between them, the channel below.
+// contains:
+//      MIXER       -- constructor
+//      set_channels(), set_frame(), clear_levels(), reset() -- the state
+//      set()       -- change one value, marking its strip
+//      repaint_dirty() -- ask for the marked strips to be drawn
+//      move()      -- a slider moved by hand, emits changed()
+//      strip_rect() -- where a channel's strip is
+//      control_at() -- the slider under the mouse
+//      paintEvent() -- draw the strips that need it
+//      paint_strip(), paint_slider() -- draw one strip, one slider
+//      mousePressEvent(), mouseMoveEvent(), mouseReleaseEvent(), wheelEvent()
+
+#include "mixer.h"
+#include <QPainter>
+#include <QPaintEvent>
+#include <QMouseEvent>
+#include <string.h>
+
+// strip size and spacing, as the frames in midi_play.ui were
+#define STRIP_W 40
+#define STRIP_H 181
+#define ROW_H 190
+// inside a strip: the two slider columns, the meter, the slider travel
+#define VOL_X 2
+#define EXP_X 26
+#define COLUMN_W 12
+#define METER_X 16
+#define METER_W 8
+#define TRACK_TOP 30
+#define TRACK_H 131
+#define HANDLE_H 8
+// wheel steps a notch moves a slider, as a QSlider does
+#define WHEEL_STEP 3
+
+MIXER::MIXER(QWidget *parent) :
+    QWidget(parent), enabled(0), dirty(0), grab_ch(-1), grab_controller(0)
+{
+    memset(volume, 0, sizeof(volume));
+    memset(expression, 0, sizeof(expression));
+    memset(level, 0, sizeof(level));
+    // every pixel is painted, nothing to clear first
+    setAttribute(Qt::WA_OpaquePaintEvent);
+}
+
+QSize MIXER::sizeHint() const {
+    return QSize(8 * STRIP_W + 1, ROW_H + STRIP_H);
+}
+
+void MIXER::set_channels(unsigned int mask) {
+    dirty |= (enabled ^ mask) & 0xffff;
+    enabled = mask & 0xffff;
+    repaint_dirty();
+}   // end set_channels
+
+void MIXER::set_frame(const struct meter_frame &frame, const struct meter_frame *last) {
+    // the meters always; a slider only where the song's value differs from
+    // last, the frame set before, as it may have been moved by hand since.
+    // With no last frame every slider takes the song's value. The strip
+    // being dragged keeps its sliders where the mouse has them
+    for (int ch = 0; ch < 16; ++ch) {
+        set(level, ch, frame.level[ch]);
+        if (ch == grab_ch)
+            continue;
+        if (!last || last->volume[ch] != frame.volume[ch])
+            set(volume, ch, frame.volume[ch]);
+        if (!last || last->expression[ch] != frame.expression[ch])
+            set(expression, ch, frame.expression[ch]);
+    }
+    repaint_dirty();
+}   // end set_frame
+
+void MIXER::clear_levels() {
+    for (int ch = 0; ch < 16; ++ch)
+        set(level, ch, 0);
+    repaint_dirty();
+}   // end clear_levels
+
+void MIXER::reset() {
+    for (int ch = 0; ch < 16; ++ch) {
+        set(volume, ch, 0);
+        set(expression, ch, 0);
+        set(level, ch, 0);
+    }
+    repaint_dirty();
+}   // end reset
+
+void MIXER::set(unsigned char *values, int ch, int value) {
+    if (value < 0)
+        value = 0;
+    else if (value > 127)
+        value = 127;
+    if (values[ch] == value)
+        return;
+    values[ch] = value;
+    dirty |= 1 << ch;
+}   // end set
+
+void MIXER::repaint_dirty() {
+    // Qt puts the strips asked for together into one paint event
+    if (!dirty)
+        return;
+    for (int ch = 0; ch < 16; ++ch)
+        if (dirty & (1 << ch))
+            update(strip_rect(ch));
+    dirty = 0;
+}   // end repaint_dirty
+
+void MIXER::move(int ch, int controller, int value) {
+    unsigned char *values = controller == 7 ? volume : expression;
+    int was = values[ch];
+    set(values, ch, value);
+    if (values[ch] == was)
+        return;
+    repaint_dirty();
+    emit changed(ch, controller, values[ch]);
+}   // end move
+
+QRect MIXER::strip_rect(int ch) const {
+    return QRect((ch % 8) * STRIP_W, (ch / 8) * ROW_H, STRIP_W + 1, STRIP_H);
+}   // end strip_rect
+
+int MIXER::control_at(const QPoint &pos, int &ch) const {
+    // controller of the slider column at pos, 0 if there is none
+    if (pos.x() < 0 || pos.y() < 0)
+        return 0;
+    ch = (pos.y() / ROW_H) * 8 + pos.x() / STRIP_W;
+    if (pos.x() >= 8 * STRIP_W || ch > 15 || !(enabled & (1 << ch)))
+        return 0;
+    int x = pos.x() % STRIP_W, y = pos.y() % ROW_H;
+    if (y < TRACK_TOP || y >= TRACK_TOP + TRACK_H)
+        return 0;
+    if (x >= VOL_X && x < VOL_X + COLUMN_W)
+        return 7;
+    if (x >= EXP_X && x < EXP_X + COLUMN_W)
+        return 0x0b;
+    return 0;
+}   // end control_at
+
+static int value_at(int y) {
+    // slider value for a y inside the strip, 127 at the top
+    int travel = TRACK_H - HANDLE_H;
+    int from_top = y % ROW_H - TRACK_TOP - HANDLE_H / 2;
+    return 127 - (from_top * 127 + travel / 2) / travel;
+}
+
+void MIXER::paintEvent(QPaintEvent *event) {
+    QPainter p(this);
+    for (int ch = 0; ch < 16; ++ch)
+        if (event->region().intersects(strip_rect(ch)))
+            paint_strip(p, ch);
+    // the gap between the rows, and anything past the strips
+    QRect gap(0, STRIP_H, 8 * STRIP_W + 1, ROW_H - STRIP_H);
+    QRect right(8 * STRIP_W + 1, 0, width(), height());
+    QRect below(0, ROW_H + STRIP_H, width(), height());
+    if (event->region().intersects(gap))
+        p.fillRect(gap, palette().color(QPalette::Window));
+    if (event->region().intersects(right))
+        p.fillRect(right, palette().color(QPalette::Window));
+    if (event->region().intersects(below))
+        p.fillRect(below, palette().color(QPalette::Window));
+}   // end paintEvent
+
+void MIXER::paint_strip(QPainter &p, int ch) {
+    QRect r = strip_rect(ch);
+    bool on = (enabled & (1 << ch)) != 0;
+    p.fillRect(r, palette().color(QPalette::Window));
+    p.setPen(palette().color(QPalette::Mid));
+    p.drawRect(r.adjusted(0, 0, -1, -1));
+    p.setPen(palette().color(on ? QPalette::Active : QPalette::Disabled, QPalette::WindowText));
+    p.drawText(QRect(r.x(), r.y() + 10, 20, 16), Qt::AlignCenter, "Vol");
+    p.drawText(QRect(r.x() + 20, r.y() + 10, 20, 16), Qt::AlignCenter, "Exp");
+    p.drawText(QRect(r.x() + 10, r.y() + 160, 20, 16), Qt::AlignCenter, QString::number(ch + 1));
+    paint_slider(p, r.x() + VOL_X, r.y(), volume[ch], on);
+    paint_slider(p, r.x() + EXP_X, r.y(), expression[ch], on);
+    // the meter fills up from the bottom
+    int top = r.y() + TRACK_TOP + HANDLE_H / 2;
+    int h = TRACK_H - HANDLE_H;
+    int fill = level[ch] * h / 127;
+    p.fillRect(r.x() + METER_X, top, METER_W, h, palette().color(QPalette::Base));
+    if (fill)
+        p.fillRect(r.x() + METER_X, top + h - fill, METER_W, fill,
+                   on ? palette().color(QPalette::Highlight) : palette().color(QPalette::Mid));
+}   // end paint_strip
+
+void MIXER::paint_slider(QPainter &p, int x, int y, int value, bool on) {
+    // groove down the middle of the column, the handle where the value is
+    int travel = TRACK_H - HANDLE_H;
+    p.fillRect(x + COLUMN_W / 2 - 1, y + TRACK_TOP + HANDLE_H / 2, 3, travel, palette().color(QPalette::Dark));
+    int hy = y + TRACK_TOP + (127 - value) * travel / 127;
+    p.fillRect(x, hy, COLUMN_W, HANDLE_H,
+               palette().color(on ? QPalette::Active : QPalette::Disabled, QPalette::Button));
+    p.setPen(palette().color(QPalette::Shadow));
+    p.drawRect(QRect(x, hy, COLUMN_W - 1, HANDLE_H - 1));
+}   // end paint_slider
+
+void MIXER::mousePressEvent(QMouseEvent *event) {
+    int ch = 0;
+    int controller = control_at(event->pos(), ch);
+    if (event->button() != Qt::LeftButton || !controller)
+        return;
+    grab_ch = ch;
+    grab_controller = controller;
+    move(ch, controller, value_at(event->pos().y()));
+}   // end mousePressEvent
+
+void MIXER::mouseMoveEvent(QMouseEvent *event) {
+    // a drag keeps to its slider, wherever the mouse goes
+    if (grab_ch < 0)
+        return;
+    int y = event->pos().y() - (grab_ch / 8) * ROW_H;
+    if (y < 0)
+        y = 0;
+    else if (y >= ROW_H)
+        y = ROW_H - 1;
+    move(grab_ch, grab_controller, value_at(y));
+}   // end mouseMoveEvent
+
+void MIXER::mouseReleaseEvent(QMouseEvent *) {
+    grab_ch = -1;
+}   // end mouseReleaseEvent
+
+void MIXER::wheelEvent(QWheelEvent *event) {
+    int ch = 0;
+    int controller = control_at(event->pos(), ch);
+    if (!controller) {
+        event->ignore();
+        return;
+    }
+    const unsigned char *values = controller == 7 ? volume : expression;
+    move(ch, controller, values[ch] + event->delta() / 120 * WHEEL_STEP);
+}   // end wheelEvent
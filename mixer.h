@@ -0,0 +1,60 @@
+// mixer.h -- part of MIDI_PLAY
+// the 16 channel strips of the window, volume and expression sliders with
+// the level meter between them, as one widget drawn by hand. The channel
+// state is kept in arrays; setting it marks the strips that changed, and
+// those alone are drawn again, all in one paint pass. Moving a slider with
+// the mouse or wheel emits changed(), setting it from the program doesn't.
+// contains:
+//      MIXER       -- the widget
+//      set_channels() -- which strips can be moved, a bit per channel
+//      set_frame() -- all meters, and the sliders the song has moved, from the meter timeline
+//      clear_levels() -- meters down, notes have stopped
+//      reset()     -- sliders and meters down, for playing from the top
+//      changed()   -- SIGNAL, channel, controller (7 or 11) and value moved to
+
+#ifndef MIXER_H
+#define MIXER_H
+
+#include <QWidget>
+#include "meters.h"
+
+class MIXER : public QWidget {
+    Q_OBJECT
+
+public:
+    MIXER(QWidget *parent = 0);
+    void set_channels(unsigned int mask);
+    void set_frame(const struct meter_frame &frame, const struct meter_frame *last);
+    void clear_levels();
+    void reset();
+    QSize sizeHint() const;
+
+signals:
+    void changed(int channel, int controller, int value);
+
+protected:
+    void paintEvent(QPaintEvent *);
+    void mousePressEvent(QMouseEvent *);
+    void mouseMoveEvent(QMouseEvent *);
+    void mouseReleaseEvent(QMouseEvent *);
+    void wheelEvent(QWheelEvent *);
+
+private:
+    QRect strip_rect(int ch) const;
+    int control_at(const QPoint &pos, int &ch) const;
+    void move(int ch, int controller, int value);
+    void set(unsigned char *values, int ch, int value);
+    void repaint_dirty();
+    void paint_strip(QPainter &p, int ch);
+    void paint_slider(QPainter &p, int x, int y, int value, bool on);
+
+    unsigned char volume[16];           // CC 7 by channel
+    unsigned char expression[16];       // CC 11
+    unsigned char level[16];            // meter
+    unsigned int enabled;               // bit n: channel n plays notes
+    unsigned int dirty;                 // bit n: strip n changed since it was drawn
+    int grab_ch;                        // strip being dragged, -1 if none; set_frame() leaves its sliders
+    int grab_controller;
+};  // end class MIXER
+
+#endif // MIXER_H
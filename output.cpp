@@ -0,0 +1,540 @@
+// output.cpp   -- part of MIDI_PLAY
+// the engine's output backends, see output.h. Every backend counts the
+// events it sends and the MIDI bytes they come to, works out once a second
+// how many it sent in that second, and keeps the average and worst of how
+// long they took: a write to the sequencer, or how late an event reached a
+// rawmidi device. The counts are kept from when the backend was made, so a
+// benchmark of a short song has them too.
+// contains:
+//      MIDI_OUTPUT -- constructor, clears the counts
+//      create()    -- a backend from a spec
+//      stats()     -- the counts and rates
+//      midi_bytes() -- the bytes an event comes to on a MIDI wire
+//      late()      -- count the latency of one event
+//      update_rates() -- once a second, the rate
+//      SEQ_OUTPUT  -- the ALSA sequencer, as the engine always used it
+//      RAW_OUTPUT  -- a rawmidi device, timed by this process
+//      CAPTURE_OUTPUT -- memory
+
+#include "output.h"
+#include <errno.h>
+#include <string.h>
+#include <algorithm>
+
+// the rates are worked out over this long, msec
+#define RATE_PERIOD 1000
+// room for a batch in the sequencer's output buffer, bytes; bigger sysex messages fit too
+#define OUTPUT_BUFFER (64 << 10)
+// events a rawmidi backend holds that aren't due yet, like the sequencer's pool
+#define RAW_POOL 500
+// bytes a rawmidi device may be behind before events wait in the pool
+#define RAW_BACKLOG 4096
+// longest channel event, bytes
+#define RAW_EVENT_BYTES 16
+// events a capture backend keeps at most
+#define CAPTURE_MAX (4 << 20)
+
+static double now_usec() {
+    struct timeval t;
+    gettimeofday(&t, NULL);
+    return t.tv_sec * 1000000.0 + t.tv_usec;
+}   // end now_usec
+
+MIDI_OUTPUT::MIDI_OUTPUT() :
+    seq(0), queue(0), events(0), bytes(0), per_second(0),
+    latency_sum(0), latency_count(0), latency_max(0), events_at_mark(0)
+{
+    gettimeofday(&mark, NULL);
+}   // end constructor
+
+MIDI_OUTPUT *MIDI_OUTPUT::create(const char *spec) {
+    // "raw:hw:1,0" for a rawmidi device, "capture" to keep what is played,
+    // "null" to throw it away; anything else is the sequencer. A device
+    // that won't open falls back to the sequencer too
+    if (spec && !strncmp(spec, "raw:", 4)) {
+        RAW_OUTPUT *raw = new RAW_OUTPUT(spec + 4);
+        if (raw->is_open())
+            return raw;
+        delete raw;
+    }
+    if (spec && !strcmp(spec, "capture"))
+        return new CAPTURE_OUTPUT(true);
+    if (spec && !strcmp(spec, "null"))
+        return new CAPTURE_OUTPUT(false);
+    return new SEQ_OUTPUT;
+}   // end create
+
+void MIDI_OUTPUT::stats(struct output_stats &s) const {
+    // read without a lock, each figure is good enough on its own
+    s.backend = name();
+    s.events = events;
+    s.bytes = bytes;
+    s.per_second = per_second;
+    unsigned long n = latency_count;
+    s.latency_usec = n ? static_cast<unsigned int>(latency_sum / n) : 0;
+    s.max_latency_usec = latency_max;
+}   // end stats
+
+unsigned int MIDI_OUTPUT::midi_bytes(const snd_seq_event_t *ev) {
+    switch (ev->type) {
+    case SND_SEQ_EVENT_NOTEON:
+    case SND_SEQ_EVENT_NOTEOFF:
+    case SND_SEQ_EVENT_KEYPRESS:
+    case SND_SEQ_EVENT_CONTROLLER:
+    case SND_SEQ_EVENT_PITCHBEND:
+        return 3;
+    case SND_SEQ_EVENT_PGMCHANGE:
+    case SND_SEQ_EVENT_CHANPRESS:
+        return 2;
+    case SND_SEQ_EVENT_SYSEX:
+        return ev->data.ext.len;
+    default:
+        // queue control, nothing goes on the wire
+        return 0;
+    }
+}   // end midi_bytes
+
+void MIDI_OUTPUT::late(long usec) {
+    if (usec < 0)
+        usec = 0;
+    latency_sum += usec;
+    ++latency_count;
+    if ((unsigned long)usec > latency_max)
+        latency_max = usec;
+}   // end late
+
+void MIDI_OUTPUT::update_rates() {
+    struct timeval t;
+    gettimeofday(&t, NULL);
+    long elapsed = (t.tv_sec - mark.tv_sec) * 1000L + (t.tv_usec - mark.tv_usec) / 1000;
+    if (elapsed < RATE_PERIOD)
+        return;
+    per_second = (events - events_at_mark) * 1000 / elapsed;
+    mark = t;
+    events_at_mark = events;
+}   // end update_rates
+
+// ---- the ALSA sequencer ----
+
+SEQ_OUTPUT::SEQ_OUTPUT() {
+    snd_seq_queue_status_malloc(&status);
+    snd_seq_queue_status_malloc(&clock_status);
+    snd_seq_queue_tempo_malloc(&queue_tempo);
+}   // end constructor
+
+SEQ_OUTPUT::~SEQ_OUTPUT() {
+    snd_seq_queue_status_free(status);
+    snd_seq_queue_status_free(clock_status);
+    snd_seq_queue_tempo_free(queue_tempo);
+}   // end destructor
+
+int SEQ_OUTPUT::start(bool resume, int) {
+    // the queue's ppq is the GUI's to set; it won't actually start until drained
+    if (snd_seq_get_output_buffer_size(seq) < OUTPUT_BUFFER)
+        snd_seq_set_output_buffer_size(seq, OUTPUT_BUFFER);
+    snd_seq_nonblock(seq, 1);
+    if (resume)
+        return snd_seq_continue_queue(seq, queue, NULL);
+    return snd_seq_start_queue(seq, queue, NULL);
+}   // end start
+
+int SEQ_OUTPUT::halt() {
+    snd_seq_drop_output(seq);
+    int err = snd_seq_stop_queue(seq, queue, NULL);
+    snd_seq_drain_output(seq);
+    snd_seq_nonblock(seq, 0);
+    return err;
+}   // end halt
+
+int SEQ_OUTPUT::locate(unsigned int tick) {
+    snd_seq_event_t ev;
+    snd_seq_drop_output(seq);
+    snd_seq_ev_clear(&ev);
+    snd_seq_ev_set_queue_pos_tick(&ev, queue, tick);
+    snd_seq_ev_set_direct(&ev);
+    return snd_seq_event_output_direct(seq, &ev);
+}   // end locate
+
+int SEQ_OUTPUT::position(unsigned int &tick) {
+    int err = snd_seq_get_queue_status(seq, queue, status);
+    if (err >= 0)
+        tick = snd_seq_queue_status_get_tick_time(status);
+    return err;
+}   // end position
+
+int SEQ_OUTPUT::tempo(unsigned int &usec, int &ppq) {
+    int err = snd_seq_get_queue_tempo(seq, queue, queue_tempo);
+    if (err >= 0) {
+        usec = snd_seq_queue_tempo_get_tempo(queue_tempo);
+        ppq = snd_seq_queue_tempo_get_ppq(queue_tempo);
+    }
+    return err;
+}   // end tempo
+
+int SEQ_OUTPUT::queued() {
+    if (snd_seq_get_queue_status(seq, queue, status) < 0)
+        return 0;
+    return snd_seq_queue_status_get_events(status);
+}   // end queued
+
+int SEQ_OUTPUT::write(snd_seq_event_t *ev) {
+    int err = snd_seq_event_output_buffer(seq, ev);
+    if (err >= 0)
+        count(ev);
+    return err < 0 ? err : 0;
+}   // end write
+
+int SEQ_OUTPUT::flush() {
+    // the time a drain takes is the write to the kernel
+    if (snd_seq_event_output_pending(seq) <= 0)
+        return 0;
+    double began = now_usec();
+    int err = snd_seq_drain_output(seq);
+    late(static_cast<long>(now_usec() - began));
+    update_rates();
+    if (err > 0)
+        return -EAGAIN;
+    return err;
+}   // end flush
+
+int SEQ_OUTPUT::send(snd_seq_event_t *ev) {
+    snd_seq_ev_set_direct(ev);
+    double began = now_usec();
+    int err = snd_seq_event_output_direct(seq, ev);
+    late(static_cast<long>(now_usec() - began));
+    if (err >= 0)
+        count(ev);
+    return err < 0 ? err : 0;
+}   // end send
+
+bool SEQ_OUTPUT::buffered() {
+    return snd_seq_event_output_pending(seq) > 0;
+}   // end buffered
+
+int SEQ_OUTPUT::take_back(int type) {
+    snd_seq_remove_events_t *remove;
+    snd_seq_remove_events_malloc(&remove);
+    snd_seq_remove_events_set_condition(remove, SND_SEQ_REMOVE_OUTPUT | SND_SEQ_REMOVE_EVENT_TYPE);
+    snd_seq_remove_events_set_queue(remove, queue);
+    snd_seq_remove_events_set_event_type(remove, type);
+    int err = snd_seq_remove_events(seq, remove);
+    snd_seq_remove_events_free(remove);
+    return err;
+}   // end take_back
+
+int SEQ_OUTPUT::poll_fds(struct pollfd *fds, int max) {
+    int n = snd_seq_poll_descriptors_count(seq, POLLOUT);
+    if (n > max)
+        n = max;
+    return snd_seq_poll_descriptors(seq, fds, n, POLLOUT);
+}   // end poll_fds
+
+void SEQ_OUTPUT::clock(unsigned int &tick, double &seconds) {
+    // the queue's own clock
+    tick = 0;
+    seconds = 0;
+    snd_seq_t *handle = seq;
+    if (!handle || snd_seq_get_queue_status(handle, queue, clock_status) < 0)
+        return;
+    tick = snd_seq_queue_status_get_tick_time(clock_status);
+    const snd_seq_real_time_t *rt = snd_seq_queue_status_get_real_time(clock_status);
+    seconds = rt->tv_sec + rt->tv_nsec / 1e9;
+}   // end clock
+
+// ---- a rawmidi device ----
+// Events wait in tick order until they are due by a clock kept here from
+// the tempo and ppq, and are then written to the device as MIDI bytes.
+// The clock only moves on at a tempo event, from the time it was due, so
+// it doesn't drift however late the writes are
+
+RAW_OUTPUT::RAW_OUTPUT(const char *device) :
+    raw(0), coder(0), running(false), base_tick(0), base_usec(0), usec_per_quarter(500000),
+    ticks_per_quarter(96), started_usec(0), played_usec(0)
+{
+    pthread_mutex_init(&clock_lock, NULL);
+    if (snd_rawmidi_open(NULL, &raw, device, SND_RAWMIDI_NONBLOCK) < 0)
+        raw = 0;
+    if (snd_midi_event_new(RAW_EVENT_BYTES, &coder) < 0)
+        coder = 0;
+}   // end constructor
+
+RAW_OUTPUT::~RAW_OUTPUT() {
+    if (raw) {
+        snd_rawmidi_drain(raw);
+        snd_rawmidi_close(raw);
+    }
+    if (coder)
+        snd_midi_event_free(coder);
+    pthread_mutex_destroy(&clock_lock);
+}   // end destructor
+
+double RAW_OUTPUT::usec_at(unsigned int tick) const {
+    // when tick is due, by the clock
+    if (tick <= base_tick)
+        return base_usec;
+    return base_usec + (double)(tick - base_tick) * usec_per_quarter / ticks_per_quarter;
+}   // end usec_at
+
+unsigned int RAW_OUTPUT::tick_now() const {
+    if (!running || !usec_per_quarter)
+        return base_tick;
+    double elapsed = now_usec() - base_usec;
+    if (elapsed <= 0)
+        return base_tick;
+    return base_tick + static_cast<unsigned int>(elapsed * ticks_per_quarter / usec_per_quarter);
+}   // end tick_now
+
+void RAW_OUTPUT::rebase(unsigned int tick, double usec) {
+    pthread_mutex_lock(&clock_lock);
+    base_tick = tick;
+    base_usec = usec;
+    pthread_mutex_unlock(&clock_lock);
+}   // end rebase
+
+int RAW_OUTPUT::start(bool resume, int ppq) {
+    double t = now_usec();
+    pthread_mutex_lock(&clock_lock);
+    if (ppq > 0)
+        ticks_per_quarter = ppq;
+    if (!resume) {
+        base_tick = 0;
+        played_usec = 0;
+    }
+    base_usec = t;
+    started_usec = t;
+    running = true;
+    pthread_mutex_unlock(&clock_lock);
+    if (coder)
+        snd_midi_event_reset_decode(coder);
+    return 0;
+}   // end start
+
+int RAW_OUTPUT::halt() {
+    // what is due by now still goes out, and what the device has been
+    // given goes out whole, a message cut short would garble the next one
+    service();
+    waiting.clear();
+    unsigned int tick = tick_now();
+    double t = now_usec();
+    pthread_mutex_lock(&clock_lock);
+    if (running)
+        played_usec += t - started_usec;
+    base_tick = tick;
+    base_usec = t;
+    running = false;
+    pthread_mutex_unlock(&clock_lock);
+    return 0;
+}   // end halt
+
+int RAW_OUTPUT::locate(unsigned int tick) {
+    waiting.clear();
+    rebase(tick, now_usec());
+    return 0;
+}   // end locate
+
+int RAW_OUTPUT::position(unsigned int &tick) {
+    tick = tick_now();
+    return 0;
+}   // end position
+
+int RAW_OUTPUT::tempo(unsigned int &usec, int &ppq) {
+    usec = usec_per_quarter;
+    ppq = ticks_per_quarter;
+    return 0;
+}   // end tempo
+
+int RAW_OUTPUT::queued() {
+    return waiting.size() + !backlog.empty();
+}   // end queued
+
+int RAW_OUTPUT::write(snd_seq_event_t *ev) {
+    // sysex is copied, the event's payload may not outlive the call
+    if (waiting.size() >= RAW_POOL)
+        return -EAGAIN;
+    struct raw_event e;
+    e.ev = *ev;
+    if (snd_seq_ev_is_variable(ev))
+        e.data.assign((const unsigned char *)ev->data.ext.ptr, (const unsigned char *)ev->data.ext.ptr + ev->data.ext.len);
+    if (waiting.empty() || waiting.back().ev.time.tick <= ev->time.tick)
+        waiting.push_back(e);
+    else {
+        std::deque<struct raw_event>::iterator at = waiting.end();
+        while (at != waiting.begin() && (at - 1)->ev.time.tick > ev->time.tick)
+            --at;
+        waiting.insert(at, e);
+    }
+    return 0;
+}   // end write
+
+int RAW_OUTPUT::flush() {
+    service();
+    return waiting.size() >= RAW_POOL ? -EAGAIN : 0;
+}   // end flush
+
+int RAW_OUTPUT::send(snd_seq_event_t *ev) {
+    // a tempo change starts from where the clock is now
+    if (ev->type == SND_SEQ_EVENT_TEMPO) {
+        unsigned int tick = tick_now();
+        pthread_mutex_lock(&clock_lock);
+        base_tick = tick;
+        base_usec = now_usec();
+        usec_per_quarter = ev->data.queue.param.value;
+        pthread_mutex_unlock(&clock_lock);
+        return 0;
+    }
+    return put_out(ev);
+}   // end send
+
+int RAW_OUTPUT::take_back(int type) {
+    std::deque<struct raw_event> keep;
+    for (unsigned int i = 0; i < waiting.size(); ++i)
+        if (waiting[i].ev.type != type)
+            keep.push_back(waiting[i]);
+    waiting.swap(keep);
+    return 0;
+}   // end take_back
+
+int RAW_OUTPUT::wait_hint() {
+    // msec until the first waiting event is due, rounded up so the wait
+    // doesn't end just short of it
+    if (!backlog.empty())
+        return 1;
+    if (!running || waiting.empty())
+        return -1;
+    double usec = usec_at(waiting.front().ev.time.tick) - now_usec();
+    if (usec <= 0)
+        return 0;
+    return static_cast<int>((usec + 999) / 1000);
+}   // end wait_hint
+
+void RAW_OUTPUT::service() {
+    // write out what is due; queue control from the song moves the clock
+    write_backlog();
+    double t = now_usec();
+    while (running && !waiting.empty() && backlog.size() < RAW_BACKLOG) {
+        struct raw_event &e = waiting.front();
+        double due = usec_at(e.ev.time.tick);
+        if (due > t)
+            break;
+        if (e.ev.type == SND_SEQ_EVENT_TEMPO) {
+            pthread_mutex_lock(&clock_lock);
+            base_tick = e.ev.time.tick;
+            base_usec = due;
+            usec_per_quarter = e.ev.data.queue.param.value;
+            pthread_mutex_unlock(&clock_lock);
+        } else if (e.ev.type == SND_SEQ_EVENT_STOP) {
+            pthread_mutex_lock(&clock_lock);
+            played_usec += due - started_usec;
+            base_tick = e.ev.time.tick;
+            base_usec = due;
+            running = false;
+            pthread_mutex_unlock(&clock_lock);
+        } else {
+            if (!e.data.empty())
+                snd_seq_ev_set_variable(&e.ev, e.data.size(), &e.data[0]);
+            late(static_cast<long>(t - due));
+            put_out(&e.ev);
+        }
+        waiting.pop_front();
+    }
+    update_rates();
+}   // end service
+
+int RAW_OUTPUT::put_out(const snd_seq_event_t *ev) {
+    // the event's bytes to the device, or to the backlog behind what is
+    // there already. Sysex goes as it is, and ends any running status
+    unsigned char buf[RAW_EVENT_BYTES];
+    const unsigned char *bytes = buf;
+    long n;
+    if (!raw || !coder)
+        return -ENODEV;
+    if (ev->type == SND_SEQ_EVENT_SYSEX) {
+        bytes = (const unsigned char *)ev->data.ext.ptr;
+        n = ev->data.ext.len;
+        snd_midi_event_reset_decode(coder);
+    } else if ((n = snd_midi_event_decode(coder, buf, sizeof(buf), ev)) <= 0)
+        return n;
+    count(ev);
+    if (backlog.empty()) {
+        ssize_t put = snd_rawmidi_write(raw, bytes, n);
+        if (put < 0 && put != -EAGAIN)
+            return put;
+        if (put > 0) {
+            bytes += put;
+            n -= put;
+        }
+    }
+    backlog.insert(backlog.end(), bytes, bytes + n);
+    return 0;
+}   // end put_out
+
+void RAW_OUTPUT::write_backlog() {
+    if (backlog.empty())
+        return;
+    ssize_t put = snd_rawmidi_write(raw, &backlog[0], backlog.size());
+    if (put > 0)
+        backlog.erase(backlog.begin(), backlog.begin() + put);
+}   // end write_backlog
+
+void RAW_OUTPUT::clock(unsigned int &tick, double &seconds) {
+    pthread_mutex_lock(&clock_lock);
+    tick = tick_now();
+    seconds = (played_usec + (running ? now_usec() - started_usec : 0)) / 1e6;
+    pthread_mutex_unlock(&clock_lock);
+}   // end clock
+
+// ---- memory ----
+// Events are played the moment they are written, so the position is the
+// last tick written and the engine has no lookahead to wait for: a song
+// goes through as fast as the engine can send it
+
+CAPTURE_OUTPUT::CAPTURE_OUTPUT(bool keep_events) :
+    keep(keep_events), last_tick(0), usec_per_quarter(500000), ticks_per_quarter(96)
+{
+    gettimeofday(&began, NULL);
+}   // end constructor
+
+int CAPTURE_OUTPUT::start(bool resume, int ppq) {
+    if (ppq > 0)
+        ticks_per_quarter = ppq;
+    if (!resume) {
+        last_tick = 0;
+        gettimeofday(&began, NULL);
+    }
+    return 0;
+}   // end start
+
+int CAPTURE_OUTPUT::tempo(unsigned int &usec, int &ppq) {
+    usec = usec_per_quarter;
+    ppq = ticks_per_quarter;
+    return 0;
+}   // end tempo
+
+int CAPTURE_OUTPUT::write(snd_seq_event_t *ev) {
+    play(ev);
+    if (ev->time.tick > last_tick)
+        last_tick = ev->time.tick;
+    return 0;
+}   // end write
+
+int CAPTURE_OUTPUT::send(snd_seq_event_t *ev) {
+    snd_seq_ev_set_direct(ev);
+    play(ev);
+    return 0;
+}   // end send
+
+void CAPTURE_OUTPUT::play(const snd_seq_event_t *ev) {
+    // kept events point at the sysex payload they were written with
+    if (ev->type == SND_SEQ_EVENT_TEMPO)
+        usec_per_quarter = ev->data.queue.param.value;
+    count(ev);
+    if (keep && kept.size() < CAPTURE_MAX)
+        kept.push_back(*ev);
+}   // end play
+
+void CAPTURE_OUTPUT::clock(unsigned int &tick, double &seconds) {
+    struct timeval t;
+    gettimeofday(&t, NULL);
+    tick = last_tick;
+    seconds = (t.tv_sec - began.tv_sec) + (t.tv_usec - began.tv_usec) / 1e6;
+}   // end clock
@@ -0,0 +1,214 @@
+// output.h -- part of MIDI_PLAY
+// where the engine's events go. The engine writes a backend the song in
+// tick order, a lookahead ahead of where it has got to, and asks it where
+// that is; each backend plays the events at their time in its own way:
+//      SEQ_OUTPUT     -- the ALSA sequencer, its queue does the timing
+//      RAW_OUTPUT     -- a rawmidi device written straight from this
+//                        process on its own clock, no sequencer in between
+//      CAPTURE_OUTPUT -- memory: plays everything as soon as it is written
+//                        and keeps it if asked to, for benchmarks on
+//                        machines without MIDI hardware
+// Backends are used by the engine thread only, except for clock() and
+// stats(), which may be called from any thread.
+// contains:
+//      output_stats -- what a backend has sent, how fast, and how late
+//      MIDI_OUTPUT -- the interface, and the counting every backend does
+//      create()    -- a backend from a spec: "seq", "raw:<device>", "capture" or "null"
+//      SEQ_OUTPUT  -- the ALSA sequencer
+//      RAW_OUTPUT  -- a rawmidi device
+//      CAPTURE_OUTPUT -- memory
+
+#ifndef OUTPUT_H
+#define OUTPUT_H
+
+#include <alsa/asoundlib.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/time.h>
+#include <vector>
+#include <deque>
+
+struct output_stats {
+    const char *backend;
+    unsigned long events;               // sent since the backend was made
+    unsigned long bytes;                // the MIDI bytes they came to
+    unsigned int per_second;            // events, over the last second of sending
+    unsigned int latency_usec;          // average, see each backend for what it measures
+    unsigned int max_latency_usec;      // worst of them
+};
+
+class MIDI_OUTPUT {
+public:
+    MIDI_OUTPUT();
+    virtual ~MIDI_OUTPUT() {}
+    static MIDI_OUTPUT *create(const char *spec);
+    virtual const char *name() const = 0;
+
+    // the sequencer handle and queue of the command being carried out
+    void bind(snd_seq_t *handle, int queue_id) { seq = handle; queue = queue_id; }
+    // start playing from the top, or continue; ppq of the song
+    virtual int start(bool resume, int ppq) = 0;
+    // drop what hasn't been played, stop where it is
+    virtual int halt() = 0;
+    // drop what hasn't been played and move the position to tick
+    virtual int locate(unsigned int tick) = 0;
+    // where playing has got to
+    virtual int position(unsigned int &tick) = 0;
+    // the tempo it plays at now, usec per quarter, and its ppq
+    virtual int tempo(unsigned int &usec, int &ppq) = 0;
+    // events are played at their time; if not, as soon as they are written,
+    // and there is no lookahead to keep to
+    virtual bool timed() const { return true; }
+    // events written that haven't been played yet
+    virtual int queued() = 0;
+    // an event to play at its tick; -EAGAIN when the buffer is full, flush() first
+    virtual int write(snd_seq_event_t *ev) = 0;
+    // pass what is written on: 0 once it all has gone, -EAGAIN while there is no room
+    virtual int flush() = 0;
+    // an event to play now, past anything written and not yet passed on
+    virtual int send(snd_seq_event_t *ev) = 0;
+    // written events are held back, waiting for flush()
+    virtual bool buffered() = 0;
+    // drop every event of one type that is waiting to be played
+    virtual int take_back(int type) = 0;
+    // descriptors to wait on for room to write, POLLOUT
+    virtual int poll_fds(struct pollfd *, int) { return 0; }
+    // msec until service() has something to do, -1 if nothing is waiting
+    virtual int wait_hint() { return -1; }
+    // play what is due, for backends that do their own timing
+    virtual void service() {}
+    // any thread: where playing has got to, and for how long it has played
+    virtual void clock(unsigned int &tick, double &seconds) = 0;
+    void stats(struct output_stats &) const;
+
+protected:
+    static unsigned int midi_bytes(const snd_seq_event_t *ev);
+    void count(const snd_seq_event_t *ev) {
+        ++events;
+        bytes += midi_bytes(ev);
+    }
+    void late(long usec);
+    void update_rates();
+
+    snd_seq_t *seq;
+    int queue;
+
+private:
+    volatile unsigned long events;
+    volatile unsigned long bytes;
+    volatile unsigned int per_second;
+    volatile double latency_sum;        // of the events late() was told of
+    volatile unsigned long latency_count;
+    volatile unsigned long latency_max;
+    struct timeval mark;                // start of the current rate period
+    unsigned long events_at_mark;
+};  // end class MIDI_OUTPUT
+
+// latency: how long each write to the sequencer takes
+class SEQ_OUTPUT : public MIDI_OUTPUT {
+public:
+    SEQ_OUTPUT();
+    ~SEQ_OUTPUT();
+    const char *name() const { return "ALSA sequencer"; }
+    int start(bool resume, int ppq);
+    int halt();
+    int locate(unsigned int tick);
+    int position(unsigned int &tick);
+    int tempo(unsigned int &usec, int &ppq);
+    int queued();
+    int write(snd_seq_event_t *ev);
+    int flush();
+    int send(snd_seq_event_t *ev);
+    bool buffered();
+    int take_back(int type);
+    int poll_fds(struct pollfd *fds, int max);
+    void clock(unsigned int &tick, double &seconds);
+
+private:
+    snd_seq_queue_status_t *status;
+    snd_seq_queue_status_t *clock_status;   // clock() may run on another thread
+    snd_seq_queue_tempo_t *queue_tempo;
+};  // end class SEQ_OUTPUT
+
+// an event waiting for its time, with its own copy of any sysex
+struct raw_event {
+    snd_seq_event_t ev;
+    std::vector<unsigned char> data;
+};
+
+// latency: how late each event is written to the device
+class RAW_OUTPUT : public MIDI_OUTPUT {
+public:
+    RAW_OUTPUT(const char *device);
+    ~RAW_OUTPUT();
+    const char *name() const { return "rawmidi"; }
+    bool is_open() const { return raw != 0; }
+    int start(bool resume, int ppq);
+    int halt();
+    int locate(unsigned int tick);
+    int position(unsigned int &tick);
+    int tempo(unsigned int &usec, int &ppq);
+    int queued();
+    int write(snd_seq_event_t *ev);
+    int flush();
+    int send(snd_seq_event_t *ev);
+    bool buffered() { return false; }
+    int take_back(int type);
+    int wait_hint();
+    void service();
+    void clock(unsigned int &tick, double &seconds);
+
+private:
+    double usec_at(unsigned int tick) const;
+    unsigned int tick_now() const;
+    void rebase(unsigned int tick, double usec);
+    int put_out(const snd_seq_event_t *ev);
+    void write_backlog();
+
+    snd_rawmidi_t *raw;
+    snd_midi_event_t *coder;
+    std::deque<struct raw_event> waiting;   // written, in tick order, not yet due
+    std::vector<unsigned char> backlog;     // bytes the device had no room for
+    // the clock, changed by the engine and read by clock() under clock_lock
+    pthread_mutex_t clock_lock;
+    bool running;
+    unsigned int base_tick;                 // the clock was at base_tick at base_usec
+    double base_usec;
+    unsigned int usec_per_quarter;
+    int ticks_per_quarter;
+    double started_usec;                    // when it last started or continued
+    double played_usec;                     // played before that
+};  // end class RAW_OUTPUT
+
+// latency: none, events are played as they are written
+class CAPTURE_OUTPUT : public MIDI_OUTPUT {
+public:
+    CAPTURE_OUTPUT(bool keep_events);
+    const char *name() const { return keep ? "capture" : "null"; }
+    int start(bool resume, int ppq);
+    int halt() { return 0; }
+    int locate(unsigned int tick) { last_tick = tick; return 0; }
+    int position(unsigned int &tick) { tick = last_tick; return 0; }
+    int tempo(unsigned int &usec, int &ppq);
+    bool timed() const { return false; }
+    int queued() { return 0; }
+    int write(snd_seq_event_t *ev);
+    int flush() { update_rates(); return 0; }
+    int send(snd_seq_event_t *ev);
+    bool buffered() { return false; }
+    int take_back(int) { return 0; }
+    void clock(unsigned int &tick, double &seconds);
+    const std::vector<snd_seq_event_t> &captured() const { return kept; }
+
+private:
+    void play(const snd_seq_event_t *ev);
+
+    bool keep;
+    std::vector<snd_seq_event_t> kept;
+    volatile unsigned int last_tick;    // the highest tick written
+    unsigned int usec_per_quarter;
+    int ticks_per_quarter;
+    struct timeval began;               // of playing from the top, for clock()
+};  // end class CAPTURE_OUTPUT
+
+#endif // OUTPUT_H
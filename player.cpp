@@ -1,222 +1,813 @@
 // player.cpp   -- part of MIDI_PLAY
-// play memory image midi data to the alsa seq port
-// requires access to "seq","queue", "ports" static vars
+// the playback engine thread, see player.h: play memory image midi data to
+// the output backend (or, for a stream, the events decoded a window at a time
+// from the file image), and carry out the GUI's commands in between. What
+// is said of the sequencer here goes for any backend, see output.h.
+// Only the events of the next lookahead msec past the queue's position are
+// queued, topped up as the queue plays on, so the kernel pool holds the same
+// small amount of the song however long it is, a pause or seek drops just
+// that, and whatever the GUI changes is heard within one lookahead.
+// Output is nonblocking: when the sequencer's pool is full the thread waits
+// in poll() for room or for the next command, whichever comes first, so a
+// pause or a controller change never waits behind the song. A backend that
+// times the events itself is serviced each time round, and the wait ends
+// when its next event is due.
+// The song is played from an image compiled when it is loaded: events are
+// copied from it into the output buffer, and the buffer goes to the
+// sequencer in one write when it is full or the batch is done.
+// Tempo events are scaled as they go out. The ones already queued are kept
+// track of until the queue plays them, so that a new scale can take them
+// back and queue them again without stopping.
+// While the song plays, the engine wakes at least once a frame to keep the
+// position the GUI shows up to date, see publish().
+// Injected events go out ahead of everything else the engine has to do;
+// sending the song stops to let them past after any one event, so the
+// added latency is a single event's write and a wake-up at most.
 // contains:
-//      check_snd()
-//      play_midi()
-
-#include "midi_play.h"
-#include "ui_midi_play.h"
-#include <alsa/asoundlib.h>
-#include <vector>
-#include <QTimer>
-
-// INLINE function
-void MIDI_PLAY::check_snd(const char *operation, int err) {
-    // error handling for ALSA functions
-    if (err < 0)
-        QMessageBox::critical(this, "MIDI Sequencer", QString("Cannot %1\n%2") .arg(operation) .arg(snd_strerror(err)));
-}
+//      PLAYER      -- constructor, makes the wake-up pipe
+//     ~PLAYER      -- destructor, ends the thread and closes the backend
+//      post()      -- queue a command for the engine
+//      inject()    -- put an event in the lane, merging controller changes
+//      sync()      -- wait for the engine to catch up with the commands
+//      stop()      -- post a pause or stop and wait for it
+//      set_lookahead() -- set how far ahead of the queue events are sent
+//      set_frame_rate() -- set how often the GUI is told of the position
+//      stats()     -- events sent and the rates they went at
+//      position()  -- the position last published, and let moved() be posted again
+//      run()       -- thread body
+//      take_commands() -- carry out the queued commands, in order
+//      send_injected() -- send the events of the lane, in one write
+//      carry_out() -- one command
+//      halt()      -- stop sending and stop the queue
+//      output_events() -- send the song to the sequencer up to the lookahead
+//      next_event() -- the next event to send: the chase burst, then the song
+//      make_event() -- build the sequencer event for one event of a store
+//      compile()   -- build the image of the whole song
+//      count_sent() -- keep the event counts and rates
+//      chase_to()  -- set up the burst that restores the channel state at a tick
+//      transpose_note() -- the pitch a note event goes out at
+//      scaled_tempo() -- the tempo a tempo event goes out at
+//      start_tempo() -- put the song's tempo where it starts on the queue, scaled
+//      retempo()   -- put a new scale on the playing queue
+//      tempo_played() -- forget the queued tempo events the queue has played
+//      horizon()   -- last tick the lookahead reaches, from the queue's position and the tempo map
+//      publish()   -- bring the position shown up to date, post moved() if it changed
+//      wait_for_work() -- sleep until there is room, the queue has moved on, a command, or the song is over
+//      check()     -- report an ALSA error
+
+#include "player.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <string.h>
+#include <unistd.h>
+
+// events decoded at a time when playing a stream; output waits once the
+// lookahead is full, so this is as far as decoding runs ahead of it
+#define STREAM_WINDOW_EVENTS 4096
+// events sent between looks at the queue's position
+#define PLAY_BATCH 256
+// songs with more events are built event by event as they play, 28 bytes an
+// event in the image would be too much
+#define IMAGE_MAX_EVENTS (2 << 20)
+// the rates are worked out over this long, msec
+#define RATE_PERIOD 1000
+// sent_pitch[][] entry for a note on that was out of range, and not sent
+#define PITCH_DROPPED 0xff
+// how often to look whether the queue has played out the end of the song, msec
+#define DRAIN_POLL 10
+// the lookahead is topped up each time this part of it has been played
+#define REFILL_PARTS 4
+#define MAX_SEQ_FDS 8
+
+PLAYER::PLAYER(EVENT_STORE &events, SMF_DECODER &song_decoder, const CHASE_TABLE &song_chase,
+               const TEMPO_MAP &song_tempo_map, MIDI_OUTPUT *output, QObject *parent) :
+    QThread(parent), all_events(events), decoder(song_decoder), chase(song_chase), tempo_map(song_tempo_map),
+    out(output ? output : new SEQ_OUTPUT),
+    lane_posted(0), posted(0), handled(0), pending(0), done(0), lookahead(DEFAULT_LOOKAHEAD),
+    frame(1000 / DEFAULT_FRAME_RATE), move_posted(false), sent(0), rate(0), dispatch_rate(0),
+    state(IDLE), now(player_cmd::STOP, 0, 0, 0), image_for(player_cmd::STOP, 0, 0, 0),
+    next(0), burst_next(0), chase_pending(false), tempo_in_force(500000), last_tick(0), stop_sent(false), blocked(false),
+    ahead(false), started(false), sent_at_mark(0), busy_usec(0)
+{
+    gettimeofday(&mark, NULL);
+    published = mark;
+    memset(&shown, 0, sizeof(shown));
+    memset(sent_pitch, 0, sizeof(sent_pitch));
+    memset(lane_slot, 0xff, sizeof(lane_slot));
+    if (pipe(wake) == 0) {
+        fcntl(wake[0], F_SETFL, O_NONBLOCK);
+        fcntl(wake[1], F_SETFL, O_NONBLOCK);
+    } else
+        wake[0] = wake[1] = -1;
+}   // end constructor
+
+PLAYER::~PLAYER() {
+    if (isRunning()) {
+        post(player_cmd(player_cmd::QUIT, 0, 0, 0));
+        wait();
+    }
+    delete out;
+    if (wake[0] >= 0) {
+        ::close(wake[0]);
+        ::close(wake[1]);
+    }
+}   // end destructor
+
+void PLAYER::post(const struct player_cmd &cmd) {
+    lock.lock();
+    commands.push_back(cmd);
+    ++posted;
+    pending = 1;
+    // a song that has just been started isn't finished, whenever the engine gets to it
+    if (cmd.op == player_cmd::PLAY || cmd.op == player_cmd::RESUME)
+        done = 0;
+    lock.unlock();
+    char c = 0;
+    if (write(wake[1], &c, 1) < 0 && errno != EAGAIN)
+        emit failed(QString("wake player\n%1") .arg(strerror(errno)));
+}   // end post
+
+void PLAYER::inject(const struct player_cmd &cmd) {
+    // a SEND that doesn't wait behind the commands. A controller already in
+    // the lane for the same destination takes the new value where it is;
+    // one for another destination is queued on its own; data entry, parameter
+    // numbers and channel mode messages mean something in their order, and
+    // are never merged. The engine is woken when the lane fills, not again
+    lock.lock();
+    bool wake_up = lane.empty();
+    unsigned char n = cmd.ev.data.control.param;
+    short *slot = 0;
+    if (cmd.ev.type == SND_SEQ_EVENT_CONTROLLER && n < 120 && n != 6 && n != 38 && (n < 96 || n > 101))
+        slot = &lane_slot[cmd.ev.data.control.channel & 0x0f][n];
+    if (slot && *slot >= 0 && lane[*slot].seq == cmd.seq &&
+        lane[*slot].ev.dest.client == cmd.ev.dest.client && lane[*slot].ev.dest.port == cmd.ev.dest.port)
+        lane[*slot].ev.data.control.value = cmd.ev.data.control.value;
+    else {
+        if (slot)
+            *slot = lane.size();
+        lane.push_back(cmd);
+    }
+    ++posted;
+    ++lane_posted;
+    pending = 1;
+    lock.unlock();
+    char c = 0;
+    if (wake_up && write(wake[1], &c, 1) < 0 && errno != EAGAIN)
+        emit failed(QString("wake player\n%1") .arg(strerror(errno)));
+}   // end inject
+
+void PLAYER::sync() {
+    // everything posted before this call has been carried out on return
+    if (!isRunning())
+        return;
+    lock.lock();
+    unsigned long target = posted;
+    while (handled < target)
+        carried_out.wait(&lock);
+    lock.unlock();
+}   // end sync
+
+void PLAYER::stop(const struct player_cmd &cmd) {
+    post(cmd);
+    sync();
+}   // end stop
+
+void PLAYER::set_lookahead(int msec) {
+    // taken up by the engine the next time it tops up the queue
+    if (msec < MIN_LOOKAHEAD)
+        msec = MIN_LOOKAHEAD;
+    if (msec > MAX_LOOKAHEAD)
+        msec = MAX_LOOKAHEAD;
+    lookahead = msec;
+}   // end set_lookahead
+
+void PLAYER::set_frame_rate(int fps) {
+    // a smoother display of the position, or fewer wake-ups of the GUI
+    if (fps < 1)
+        fps = 1;
+    if (fps > MAX_FRAME_RATE)
+        fps = MAX_FRAME_RATE;
+    frame = 1000 / fps;
+}   // end set_frame_rate
+
+void PLAYER::position(struct player_position &p) {
+    // the GUI has seen the position; the next change posts moved() again
+    lock.lock();
+    p = shown;
+    move_posted = false;
+    lock.unlock();
+}   // end position
+
+void PLAYER::stats(struct player_stats &s) const {
+    // read without the lock, each figure is good enough on its own
+    s.events = sent;
+    s.per_second = rate;
+    s.dispatch_rate = dispatch_rate;
+}   // end stats
+
+void PLAYER::run() {
+    while (take_commands()) {
+        out->service();
+        if (state == PLAYING)
+            output_events();
+        publish(false);
+        wait_for_work();
+    }
+}   // end run
 
-void MIDI_PLAY::play_midi(unsigned int startTick) {
-    int end_delay = 2;
+bool PLAYER::take_commands() {
+    // returns false once QUIT has been carried out
+    bool quit = false;
+    if (!pending)
+        return true;
+    lock.lock();
+    std::deque<struct player_cmd> todo;
+    todo.swap(commands);
+    std::vector<struct player_cmd> injected;
+    injected.swap(lane);
+    unsigned long injects = lane_posted;
+    lane_posted = 0;
+    memset(lane_slot, 0xff, sizeof(lane_slot));
+    pending = 0;
+    lock.unlock();
+    char buf[64];
+    while (read(wake[0], buf, sizeof(buf)) > 0)
+        ;
+    send_injected(injected);
+    for (unsigned int i = 0; i < todo.size(); ++i) {
+        if (todo[i].op == player_cmd::QUIT)
+            quit = true;
+        else
+            carry_out(todo[i]);
+    }
+    lock.lock();
+    handled += todo.size() + injects;
+    carried_out.wakeAll();
+    lock.unlock();
+    return !quit;
+}   // end take_commands
+
+void PLAYER::send_injected(std::vector<struct player_cmd> &todo) {
+    // direct events, all put in the output buffer and passed on in one
+    // write. Song events waiting in the buffer for room in the pool would
+    // hold them up; then each one is written past them on its own
+    snd_seq_t *seq = 0;
+    bool past = false;
+    int err;
+    for (unsigned int i = 0; i < todo.size(); ++i) {
+        struct player_cmd &cmd = todo[i];
+        if (!cmd.seq)
+            continue;
+        if (cmd.seq != seq) {
+            if (seq && !past && (err = out->flush()) != -EAGAIN)
+                check("drain output", err);
+            seq = cmd.seq;
+            out->bind(cmd.seq, cmd.queue);
+            past = out->buffered();
+        }
+        if (!cmd.sysex.empty())
+            snd_seq_ev_set_variable(&cmd.ev, cmd.sysex.size(), &cmd.sysex[0]);
+        snd_seq_ev_set_direct(&cmd.ev);
+        if (past)
+            err = out->send(&cmd.ev);
+        else if ((err = out->write(&cmd.ev)) == -EAGAIN) {
+            // the buffer is full of the lane, pass that on first
+            out->flush();
+            err = out->write(&cmd.ev);
+        }
+        check("send event", err);
+    }
+    if (seq && !past && (err = out->flush()) != -EAGAIN)
+        check("drain output", err);
+    if (state != IDLE)
+        out->bind(now.seq, now.queue);
+}   // end send_injected
+
+void PLAYER::carry_out(struct player_cmd &cmd) {
     int err;
-    // set data in (snd_seq_event_t ev) and output the event
-    // common settings for all events
+    if (cmd.op == player_cmd::SONG) {
+        // the GUI only changes the song while nothing plays
+        compile(cmd);
+        return;
+    }
+    if (!cmd.seq)
+        return;
+    out->bind(cmd.seq, cmd.queue);
+    switch (cmd.op) {
+    case player_cmd::PLAY:
+    case player_cmd::RESUME:
+        now = cmd;
+        // the image is made for one queue and routing
+        if (!now.streaming && (image.size() != all_events.size() || !image_for.same_routing(now)))
+            compile(now);
+        gettimeofday(&mark, NULL);
+        sent_at_mark = sent;
+        busy_usec = 0;
+        err = out->start(cmd.op == player_cmd::RESUME, now.ppq);
+        check("start queue", err);
+        started = false;
+        next = now.streaming ? 0 : all_events.find(now.tick);
+        stop_sent = false;
+        last_tick = all_events.last_tick();
+        window.clear();
+        if (now.streaming)
+            decoder.stream_rewind();
+        // notes held over a pause still end at the pitch they started at
+        if (cmd.op == player_cmd::PLAY)
+            memset(sent_pitch, 0, sizeof(sent_pitch));
+        // from the top, the song sets everything up itself
+        burst.clear();
+        burst_next = 0;
+        if (chase_pending || (cmd.op == player_cmd::PLAY && now.tick > 0))
+            chase_to(now.tick);
+        chase_pending = false;
+        start_tempo();
+        state = PLAYING;
+        break;
+    case player_cmd::PAUSE:
+    case player_cmd::STOP:
+        halt(cmd);
+        if (cmd.op == player_cmd::STOP) {
+            window.clear();
+            chase_pending = false;
+            memset(sent_pitch, 0, sizeof(sent_pitch));
+        }
+        break;
+    case player_cmd::SEEK:
+        // move the queue; if it's playing, carry on from the new place
+        err = out->locate(cmd.tick);
+        check("set queue position", err);
+        publish(true);
+        if (state != IDLE) {
+            now.tick = cmd.tick;
+            next = now.streaming ? 0 : all_events.find(now.tick);
+            stop_sent = false;
+            window.clear();
+            if (now.streaming)
+                decoder.stream_rewind();
+            chase_to(now.tick);
+            start_tempo();
+            state = PLAYING;
+        } else
+            chase_pending = true;
+        memset(sent_pitch, 0, sizeof(sent_pitch));
+        break;
+    case player_cmd::TRANSPOSE:
+        // takes effect with the next event sent, what is queued already
+        // plays out as it is, one lookahead at most
+        now.transpose = cmd.transpose;
+        break;
+    case player_cmd::TEMPO:
+        now.tempo_scale = cmd.tempo_scale;
+        now.tempo_override = cmd.tempo_override;
+        if (state != IDLE)
+            retempo();
+        break;
+    case player_cmd::SEND:
+        // straight to the port, between the events of the song
+        if (!cmd.sysex.empty())
+            snd_seq_ev_set_variable(&cmd.ev, cmd.sysex.size(), &cmd.sysex[0]);
+        err = out->send(&cmd.ev);
+        check("send event", err);
+        break;
+    default:
+        break;
+    }   // end SWITCH op
+}   // end carry_out
+
+void PLAYER::halt(const struct player_cmd &) {
+    // drop whatever hasn't been played yet and stop the queue where it is
+    int err = out->halt();
+    check("stop queue", err);
+    // a stream resumes at the tempo it had got to
+    unsigned int tick;
+    if (started && out->position(tick) >= 0)
+        tempo_played(tick);
+    tempos_queued.clear();
+    state = IDLE;
+    blocked = false;
+    ahead = false;
+    rate = 0;
+    // the GUI reads where it stopped as soon as stop() returns
+    publish(true);
+}   // end halt
+
+void PLAYER::output_events() {
+    // fill the output buffer until the lookahead or the pool is full, a
+    // command comes in or the song is out; the buffer goes to the sequencer
+    // whenever it is full, and at the end
+    struct timeval began;
+    gettimeofday(&began, NULL);
     snd_seq_event_t ev;
-    snd_seq_ev_clear(&ev);
-    ev.queue = queue;
-    ev.source.port = 0;
-    ev.flags = SND_SEQ_TIME_STAMP_TICK;
-    // parse each event, already in sort order by 'tick' from parse_file
-    for (std::vector<event>::iterator Event=all_events.begin(); Event!=all_events.end(); ++Event)  {
-        // skip over everything except TEMPO, CONTROLLER, PROGRAM, VELOCITY changes until startTick is reached.
-        if (Event->tick<startTick &&
-            (Event->type!=SND_SEQ_EVENT_TEMPO ||
-             Event->type!=SND_SEQ_EVENT_CONTROLLER ||
-             Event->type!=SND_SEQ_EVENT_PGMCHANGE ||
-             Event->type!=SND_SEQ_EVENT_CHANPRESS ||
-             Event->type!=SND_SEQ_EVENT_SYSEX ||
-             Event->type!=SND_SEQ_EVENT_KEYSIGN)) 
-	    { continue; }
-        ev.time.tick = Event->tick;
-        ev.type = Event->type;
-        ev.dest = ports[0];
-        switch (ev.type) {
-        case SND_SEQ_EVENT_NOTEON:
-        case SND_SEQ_EVENT_NOTEOFF:
-        case SND_SEQ_EVENT_KEYPRESS:
-            snd_seq_ev_set_fixed(&ev);
-            ev.data.note.channel = Event->data.d[0];
-            ev.data.note.note = Event->data.d[1]+(Event->data.d[0]==9?0: ui->MIDI_Transpose->value());
-            ev.data.note.velocity = Event->data.d[2];
-            break;
-        case SND_SEQ_EVENT_CONTROLLER:
-            snd_seq_ev_set_fixed(&ev);
-            ev.data.control.channel = Event->data.d[0];
-            ev.data.control.param = Event->data.d[1];
-            ev.data.control.value = Event->data.d[2];
-            break;
-        case SND_SEQ_EVENT_PGMCHANGE:
-        case SND_SEQ_EVENT_CHANPRESS:
-            snd_seq_ev_set_fixed(&ev);
-            ev.data.control.channel = Event->data.d[0];
-            ev.data.control.value = Event->data.d[1];
-            break;
-        case SND_SEQ_EVENT_PITCHBEND:
-            snd_seq_ev_set_fixed(&ev);
-            ev.data.control.channel = Event->data.d[0];
-            ev.data.control.value =
-                ((Event->data.d[1]) |
-                 ((Event->data.d[2]) << 7)) - 0x2000;
-            break;
-        case SND_SEQ_EVENT_SYSEX:
-            snd_seq_ev_set_variable(&ev, Event->data.length, &Event->sysex);
+    int err;
+    int written = 0;
+    unsigned int n = 0;
+    unsigned int last = horizon();
+    while (n < PLAY_BATCH && !pending) {
+        bool chasing = burst_next < burst.size();
+        if (!next_event(ev)) {
+            state = DRAINING;
             break;
-        case SND_SEQ_EVENT_TEMPO:
-            snd_seq_ev_set_fixed(&ev);
-            ev.dest.client = SND_SEQ_CLIENT_SYSTEM;
-            ev.dest.port = SND_SEQ_PORT_SYSTEM_TIMER;
-            ev.data.queue.queue = queue;
-            ev.data.queue.param.value = Event->data.tempo;
+        }
+        if (ev.time.tick > last) {
+            ahead = true;       // next_event() gives the same event again
             break;
-        case SND_SEQ_EVENT_KEYSIGN:
-	  if (ui->MIDI_KeySig->text().size() && Event->data.d[2]==minor_key && Event->data.d[1]==sf) break;
-            ui->MIDI_KeySig->clear();
-            if (Event->data.d[2]) {	// minor key
-                switch(Event->data.d[1]) {
-                case 0:
-                    ui->MIDI_KeySig->setText("a minor");
-                    break;
-                case 1:
-                    ui->MIDI_KeySig->setText("e minor");
-                    break;
-                case 2:
-                    ui->MIDI_KeySig->setText("b minor");
-                    break;
-                case 3:
-                    ui->MIDI_KeySig->setText("f# minor");
-                    break;
-                case 4:
-                    ui->MIDI_KeySig->setText("c# minor");
-                    break;
-                case 5:
-                    ui->MIDI_KeySig->setText("g# minor");
-                    break;
-                case 6:
-                    ui->MIDI_KeySig->setText("d# minor");
-                    break;
-                case 7:
-                    ui->MIDI_KeySig->setText("a# minor");
-                    break;
-                case 0xff:
-                    ui->MIDI_KeySig->setText("d minor");
-                    break;
-                case 0xfe:
-                    ui->MIDI_KeySig->setText("g minor");
-                    break;
-                case 0xfd:
-                    ui->MIDI_KeySig->setText("c minor");
-                    break;
-                case 0xFC:
-                    ui->MIDI_KeySig->setText("f minor");
-                    break;
-                case 0xFB:
-                    ui->MIDI_KeySig->setText("bf minor");
-                    break;
-                case 0xFA:
-                    ui->MIDI_KeySig->setText("ef minor");
-                    break;
-                case 0xF9:
-                    ui->MIDI_KeySig->setText("af minor");
-                    break;
-                }
-            }
-            else {	// major key
-                switch(Event->data.d[1]) {
-                case 0:
-                    ui->MIDI_KeySig->setText("C Major");
-                    break;
-                case 1:
-                    ui->MIDI_KeySig->setText("G Major");
-                    break;
-                case 2:
-                    ui->MIDI_KeySig->setText("D Major");
-                    break;
-                case 3:
-                    ui->MIDI_KeySig->setText("A Major");
-                    break;
-                case 4:
-                    ui->MIDI_KeySig->setText("E Major");
-                    break;
-                case 5:
-                    ui->MIDI_KeySig->setText("B Major");
-                    break;
-                case 6:
-                    ui->MIDI_KeySig->setText("F# Major");
-                    break;
-                case 7:
-                    ui->MIDI_KeySig->setText("C# Major");
-                    break;
-                case 0xFF:
-                    ui->MIDI_KeySig->setText("F Major");
-                    break;
-                case 0xFE:
-                    ui->MIDI_KeySig->setText("Bf Major");
-                    break;
-                case 0xFD:
-                    ui->MIDI_KeySig->setText("Ef Major");
-                    break;
-                case 0xFC:
-                    ui->MIDI_KeySig->setText("Af Major");
-                    break;
-                case 0xFB:
-                    ui->MIDI_KeySig->setText("Df Major");
-                    break;
-                case 0xFA:
-                    ui->MIDI_KeySig->setText("Gf Major");
-                    break;
-                case 0xF9:
-                    ui->MIDI_KeySig->setText("Cf Major");
-                    break;
-		default:
-		  ui->MIDI_KeySig->clear();
-		  break;
-                }
+        }
+        if (ev.type == SND_SEQ_EVENT_TEMPO) {
+            written = ev.data.queue.param.value;
+            ev.data.queue.param.value = scaled_tempo(written);
+        }
+        err = out->write(&ev);
+        if (err == -EAGAIN) {
+            // the buffer is full: pass it on, and carry on if the pool takes it all
+            err = out->flush();
+            if (err != 0) {
+                if (err != -EAGAIN)
+                    check("drain output", err);
+                blocked = true;     // pool is full, next_event() gives the same event again
+                break;
             }
-            break;
-        default:
-            QMessageBox::critical(this, "MIDI Sequencer", QString("Invalid event type %1") .arg(ev.type));
-	    return;
-        }   // end SWITCH ev.type
-        // this blocks when the output pool has been filled
-        err = snd_seq_event_output(seq, &ev);
-        check_snd("output event", err);
-//	if (ev.type == SND_SEQ_EVENT_TEMPO) ui->MIDI_Tempo_Master->setValue((int)snd_seq_queue_tempo_get_tempo(queue_tempo)*2);
-    }	// end for (read loop)
+            err = out->write(&ev);
+        }
+        // the song itself never holds a queue STOP, that's our own at the end
+        if (ev.type == SND_SEQ_EVENT_TEMPO) {
+            struct queued_tempo t = { ev.time.tick, written };
+            tempos_queued.push_back(t);
+        }
+        if (ev.type == SND_SEQ_EVENT_STOP)
+            stop_sent = true;
+        else if (chasing)
+            ++burst_next;
+        else
+            ++next;
+        ++n;
+        check("output event", err);
+    }
+    // make sure that the sequencer sees our events; without room it takes
+    // the rest later, see wait_for_work()
+    err = out->flush();
+    if (err != -EAGAIN)
+        check("drain output", err);
+    started = true;     // the start or continue went first
+    count_sent(n, began);
+}   // end output_events
 
+bool PLAYER::next_event(snd_seq_event_t &ev) {
+    // the chase burst first, if there is one; then build the event at next,
+    // skipping what comes before the start tick (a stream window has no
+    // index to go straight there) and notes transposed out of range; after
+    // the last one, the queue stop at the end of the song
+    if (burst_next < burst.size()) {
+        make_event(burst, burst_next, now, ev);
+        return true;
+    }
+    EVENT_STORE &events = now.streaming ? window : all_events;
+    for (;;) {
+        if (next >= events.size()) {
+            if (!now.streaming || !decoder.stream_fill(window, STREAM_WINDOW_EVENTS))
+                break;
+            last_tick = window.last_tick();
+            next = 0;
+            continue;
+        }
+        if (events.tick(next) < now.tick) {
+            ++next;
+            continue;
+        }
+        if (!now.streaming && !image.empty())
+            ev = image[next];
+        else
+            make_event(events, next, now, ev);
+        if (transpose_note(ev))
+            return true;
+        ++next;
+    }
     // schedule queue stop at end of song
+    if (stop_sent)
+        return false;
+    snd_seq_ev_clear(&ev);
+    ev.queue = now.queue;
+    ev.source.port = 0;
+    ev.flags = SND_SEQ_TIME_STAMP_TICK;
     snd_seq_ev_set_fixed(&ev);
     ev.type = SND_SEQ_EVENT_STOP;
-    ev.time.tick = all_events.back().tick;
+    ev.time.tick = last_tick;
     ev.dest.client = SND_SEQ_CLIENT_SYSTEM;
     ev.dest.port = SND_SEQ_PORT_SYSTEM_TIMER;
-    ev.data.queue.queue = queue;
-    err = snd_seq_event_output(seq, &ev);
-    check_snd("output event", err);
-    // make sure that the sequencer sees all our events
-    err = snd_seq_drain_output(seq);
-    check_snd("drain output", err);
-
-    // There are three possibilities for how to wait until all events have been played:
-    // 1) send an event back to us (like pmidi does), and wait for it;
-    // 2) wait for the EVENT_STOP notification for our queue which is sent
-    //    by the system timer port (this would require a subscription);
-    // 3) wait until the output pool is empty.
-    // The last is the simplest.
-    err = snd_seq_sync_output_queue(seq);
-    check_snd("sync output", err);
-    // give the last notes time to die away
-    if (end_delay > 0)
-        sleep(end_delay);
-}   // end play_midi
+    ev.data.queue.queue = now.queue;
+    return true;
+}   // end next_event
+
+bool PLAYER::transpose_note(snd_seq_event_t &ev) {
+    // set the pitch of a note event, false if it is not to be sent.
+    // A note on goes out at the transpose of the moment, and its pitch is
+    // kept; the note off and aftertouch of that note go to the same pitch,
+    // however the transpose has changed since. Only note ons write the
+    // table, so building the same event again gives the same result
+    switch (ev.type) {
+    case SND_SEQ_EVENT_NOTEON:
+    case SND_SEQ_EVENT_NOTEOFF:
+    case SND_SEQ_EVENT_KEYPRESS:
+        break;
+    default:
+        return true;
+    }
+    unsigned char channel = ev.data.note.channel & 0x0f;
+    unsigned char note = ev.data.note.note & 0x7f;
+    if (channel == 9)
+        return true;        // drums aren't transposed
+    unsigned char &sent = sent_pitch[channel][note];
+    int pitch = note + now.transpose;
+    if (ev.type == SND_SEQ_EVENT_NOTEON && ev.data.note.velocity) {
+        if (pitch < 0 || pitch > 127) {
+            sent = PITCH_DROPPED;
+            return false;
+        }
+        sent = pitch + 1;
+    } else if (sent == PITCH_DROPPED)
+        return false;
+    else if (sent)
+        pitch = sent - 1;
+    else if (pitch < 0 || pitch > 127)
+        return false;
+    ev.data.note.note = pitch;
+    return true;
+}   // end transpose_note
+
+int PLAYER::scaled_tempo(int written) const {
+    // usec per quarter: the override if there is one, else the written
+    // tempo made faster or slower by the scale
+    if (now.tempo_override > 0)
+        return now.tempo_override;
+    if (now.tempo_scale <= 0 || now.tempo_scale == 1.0)
+        return written;
+    int tempo = static_cast<int>(written / now.tempo_scale + 0.5);
+    return tempo > 0 ? tempo : 1;
+}   // end scaled_tempo
+
+void PLAYER::start_tempo() {
+    // set the queue going at the song's tempo where it starts, scaled. A
+    // stream has no snapshots and is only ever played from the top, or
+    // resumed where halt() saw its tempo had got to
+    if (!now.streaming || now.op == player_cmd::PLAY) {
+        struct chase_state state;
+        chase.state_at(all_events, next, state);
+        tempo_in_force = state.tempo;
+    }
+    tempos_queued.clear();
+    snd_seq_event_t ev;
+    snd_seq_ev_clear(&ev);
+    snd_seq_ev_set_queue_tempo(&ev, now.queue, scaled_tempo(tempo_in_force));
+    int err = out->send(&ev);
+    check("set tempo", err);
+}   // end start_tempo
+
+void PLAYER::retempo() {
+    // the scale has changed while the queue plays: the tempo in force now
+    // changes at once, and the tempo events queued ahead of the queue's
+    // position are taken back and queued again at the new scale; nothing
+    // else that is queued is touched, so nothing is heard to stop
+    int err;
+    unsigned int tick = now.tick, played;
+    if (started) {
+        err = out->position(played);
+        check("get queue status", err);
+        if (err >= 0 && played > tick)
+            tick = played;
+    }
+    tempo_played(tick);
+    err = out->take_back(SND_SEQ_EVENT_TEMPO);
+    check("take back tempo events", err);
+    snd_seq_event_t ev;
+    snd_seq_ev_clear(&ev);
+    snd_seq_ev_set_queue_tempo(&ev, now.queue, scaled_tempo(tempo_in_force));
+    err = out->send(&ev);
+    check("set tempo", err);
+    // as many events as were just taken back, so the pool has room for them
+    for (unsigned int i = 0; i < tempos_queued.size(); ++i) {
+        snd_seq_ev_clear(&ev);
+        ev.queue = now.queue;
+        ev.source.port = 0;
+        ev.flags = SND_SEQ_TIME_STAMP_TICK;
+        ev.time.tick = tempos_queued[i].tick;
+        snd_seq_ev_set_fixed(&ev);
+        snd_seq_ev_set_queue_tempo(&ev, now.queue, scaled_tempo(tempos_queued[i].tempo));
+        err = out->write(&ev);
+        if (err == -EAGAIN) {
+            out->flush();
+            err = out->write(&ev);
+        }
+        check("queue tempo event", err);
+    }
+    err = out->flush();
+    if (err != -EAGAIN)
+        check("drain output", err);
+}   // end retempo
+
+void PLAYER::tempo_played(unsigned int tick) {
+    // the queue has got to tick: its tempo is the last one played by then
+    while (!tempos_queued.empty() && tempos_queued.front().tick <= tick) {
+        tempo_in_force = tempos_queued.front().tempo;
+        tempos_queued.pop_front();
+    }
+}   // end tempo_played
+
+void PLAYER::make_event(const EVENT_STORE &events, unsigned int i, const struct player_cmd &target, snd_seq_event_t &ev) {
+    // the event as it goes to target's queue, and the destination its song
+    // port and channel are routed to, without transposing
+    snd_seq_ev_clear(&ev);
+    ev.queue = target.queue;
+    ev.source.port = 0;
+    ev.flags = SND_SEQ_TIME_STAMP_TICK;
+    ev.time.tick = events.tick(i);
+    ev.type = events.type(i);
+    ev.dest = target.dest_for(events.port(i), ev.type == SND_SEQ_EVENT_SYSEX ? -1 : events.channel(i));
+    switch (ev.type) {
+    case SND_SEQ_EVENT_NOTEON:
+    case SND_SEQ_EVENT_NOTEOFF:
+    case SND_SEQ_EVENT_KEYPRESS:
+        snd_seq_ev_set_fixed(&ev);
+        ev.data.note.channel = events.channel(i);
+        ev.data.note.note = events.data1(i);
+        ev.data.note.velocity = events.data2(i);
+        break;
+    case SND_SEQ_EVENT_CONTROLLER:
+        snd_seq_ev_set_fixed(&ev);
+        ev.data.control.channel = events.channel(i);
+        ev.data.control.param = events.data1(i);
+        ev.data.control.value = events.data2(i);
+        break;
+    case SND_SEQ_EVENT_PGMCHANGE:
+    case SND_SEQ_EVENT_CHANPRESS:
+        snd_seq_ev_set_fixed(&ev);
+        ev.data.control.channel = events.channel(i);
+        ev.data.control.value = events.data1(i);
+        break;
+    case SND_SEQ_EVENT_PITCHBEND:
+        snd_seq_ev_set_fixed(&ev);
+        ev.data.control.channel = events.channel(i);
+        ev.data.control.value =
+            ((events.data1(i)) |
+             ((events.data2(i)) << 7)) - 0x2000;
+        break;
+    case SND_SEQ_EVENT_SYSEX:
+        // point ALSA straight at the payload in the song's sysex arena
+        snd_seq_ev_set_variable(&ev, events.sysex_length(i), const_cast<unsigned char *>(events.sysex_data(i)));
+        break;
+    case SND_SEQ_EVENT_TEMPO:
+        snd_seq_ev_set_fixed(&ev);
+        ev.dest.client = SND_SEQ_CLIENT_SYSTEM;
+        ev.dest.port = SND_SEQ_PORT_SYSTEM_TIMER;
+        ev.data.queue.queue = target.queue;
+        ev.data.queue.param.value = events.tempo(i);
+        break;
+    default:
+        // the decoder stores nothing else
+        break;
+    }   // end SWITCH ev.type
+}   // end make_event
+
+void PLAYER::compile(const struct player_cmd &target) {
+    // build every event of the song once, for target's queue and routing;
+    // sysex events point into the store's arena, which stays put while the
+    // song is loaded. A song too big for an image is built as it plays
+    std::vector<snd_seq_event_t>().swap(image);
+    image_for = target;
+    if (all_events.empty() || all_events.size() > IMAGE_MAX_EVENTS)
+        return;
+    image.resize(all_events.size());
+    for (unsigned int i = 0; i < all_events.size(); ++i)
+        make_event(all_events, i, target, image[i]);
+}   // end compile
+
+void PLAYER::count_sent(unsigned int n, const struct timeval &began) {
+    // events sent, and once every RATE_PERIOD the rates: per second of
+    // playing, and per second of actually sending
+    struct timeval t;
+    gettimeofday(&t, NULL);
+    busy_usec += (t.tv_sec - began.tv_sec) * 1000000L + t.tv_usec - began.tv_usec;
+    sent += n;
+    long elapsed = (t.tv_sec - mark.tv_sec) * 1000L + (t.tv_usec - mark.tv_usec) / 1000;
+    if (elapsed < RATE_PERIOD)
+        return;
+    unsigned long k = sent - sent_at_mark;
+    rate = k * 1000 / elapsed;
+    dispatch_rate = busy_usec ? static_cast<unsigned int>(k * 1000000.0 / busy_usec) : 0;
+    mark = t;
+    sent_at_mark = sent;
+    busy_usec = 0;
+}   // end count_sent
+
+void PLAYER::chase_to(unsigned int tick) {
+    // a stream has no chase table, it is only ever played from the top
+    burst.clear();
+    burst_next = 0;
+    if (!now.streaming)
+        chase.restore(all_events, next, tick, burst);
+}   // end chase_to
+
+unsigned int PLAYER::horizon() {
+    // the queue's position plus the lookahead. A loaded song played at its
+    // own tempo, scaled or not, is converted through the tempo map, which
+    // knows of the tempo changes inside the lookahead; held, or streamed,
+    // at the queue's current tempo, and the next top-up puts a change right
+    int err;
+    unsigned int tick = now.tick, played;
+    // until our start has gone out, the queue still stands where it was
+    if (started) {
+        err = out->position(played);
+        check("get queue status", err);
+        if (err >= 0 && played > tick)
+            tick = played;
+        tempo_played(tick);
+    }
+    if (!out->timed())
+        return ~0U;     // nothing to wait for
+    if (!now.streaming && now.tempo_override <= 0 && tempo_map.size() > 1) {
+        double scale = now.tempo_scale > 0 ? now.tempo_scale : 1.0;
+        return tempo_map.tick_at(tempo_map.usec_at(tick) + lookahead * 1000.0 * scale) + 1;
+    }
+    unsigned int usec = 0;
+    int ppq = 0;
+    err = out->tempo(usec, ppq);
+    check("get queue tempo", err);
+    if (err < 0 || !usec)
+        return tick;
+    double ticks = lookahead * 1000.0 * ppq / usec;
+    return tick + static_cast<unsigned int>(ticks) + 1;
+}   // end horizon
+
+void PLAYER::publish(bool at_once) {
+    // once a frame while the song plays, and at once for a stop, a seek or
+    // the end of the song: shown becomes where the backend has got to, and
+    // if that has moved the GUI is told, unless it still has a moved() to
+    // read. Stopped, the engine doesn't look, the position can't change
+    struct timeval t;
+    gettimeofday(&t, NULL);
+    if (!at_once) {
+        long elapsed = (t.tv_sec - published.tv_sec) * 1000L + (t.tv_usec - published.tv_usec) / 1000;
+        if (state == IDLE || elapsed < frame)
+            return;
+    }
+    published = t;
+    struct player_position p;
+    out->clock(p.tick, p.seconds);
+    p.finished = done;
+    lock.lock();
+    bool post_it = (p.tick != shown.tick || p.finished != shown.finished) && !move_posted;
+    shown = p;
+    if (post_it)
+        move_posted = true;
+    lock.unlock();
+    if (post_it)
+        emit moved();
+}   // end publish
+
+void PLAYER::wait_for_work() {
+    // IDLE: until a command comes. PLAYING: until the sequencer has room,
+    // or with the lookahead full, until the queue has played a part of it.
+    // DRAINING: until the queue has played the last event, looking every
+    // DRAIN_POLL msec, then the song is finished. In any state, no longer
+    // than until the backend has an event due, and unless IDLE, a frame
+    struct pollfd fds[1 + MAX_SEQ_FDS];
+    int nfds = 1;
+    int timeout = -1;
+    fds[0].fd = wake[0];
+    fds[0].events = POLLIN;
+    if (state != IDLE) {
+        int left = out->flush();
+        if (state == PLAYING && left == 0 && !blocked && !ahead)
+            return;     // only stopped for a look at the commands
+        if (left != 0 || blocked) {
+            // wait for room in the pool, or for the rest of the buffer to go
+            nfds += out->poll_fds(fds + 1, MAX_SEQ_FDS);
+        } else if (ahead) {
+            timeout = lookahead / REFILL_PARTS;
+        } else if (state == DRAINING) {
+            if (!out->queued()) {
+                done = 1;
+                out->halt();
+                state = IDLE;
+                rate = 0;
+                publish(true);
+            } else
+                timeout = DRAIN_POLL;
+        }
+        blocked = false;
+        ahead = false;
+    }
+    int due = out->wait_hint();
+    if (due >= 0 && (timeout < 0 || due < timeout))
+        timeout = due;
+    if (state != IDLE && (timeout < 0 || frame < timeout))
+        timeout = frame;
+    if (!pending)
+        poll(fds, nfds, timeout);
+}   // end wait_for_work
+
+void PLAYER::check(const char *operation, int err) {
+    // the GUI shows the error, this thread mustn't
+    if (err < 0)
+        emit failed(QString("Cannot %1\n%2") .arg(operation) .arg(snd_strerror(err)));
+}   // end check
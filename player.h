@@ -0,0 +1,244 @@
+// player.h -- part of MIDI_PLAY
+// the playback engine: one thread, started with the window and kept until it
+// closes, that sends the song to its output: the ALSA sequencer, or any
+// other backend of output.h, chosen when the window opens. The GUI drives it with
+// commands and does not write to the sequencer itself while the engine is
+// there; the engine never touches a widget, ALSA errors come back by signal.
+// Every command carries the sequencer handle, queue and ports it is for, as
+// the GUI opens and closes the sequencer around loading a song. The song can
+// go to several ports at once: each event is routed by its song port (the
+// 0x21 meta of its track) and channel to one of the command's destinations.
+// Starting anywhere but the top of the song, the engine first sends the
+// channel state in force there, taken from the song's CHASE_TABLE. How far
+// ahead of the queue it writes is reckoned through the song's TEMPO_MAP.
+// A loaded song is compiled once into an image of ready-made sequencer
+// events, so playing it is a copy per event rather than a build. The
+// transpose is put on as each note goes out, so it can change mid-song.
+// Live controller changes and sysex from the GUI take a lane of their own
+// past the commands: a controller moved again before the engine got to it
+// goes out once, at its last value, and the lane is emptied in one write.
+// So is the tempo scale: every tempo event of the song goes out scaled, or
+// replaced by a fixed tempo, and a change is put on the queue straight away.
+// The queue is the backend's: where playing has got to and at what tempo
+// is asked of it. The GUI doesn't ask; while the song plays the engine
+// looks once a frame and, if the position has moved, posts moved() to the
+// GUI, which reads the position the engine kept with position(). One
+// moved() is out at a time, so a GUI that falls behind gets the latest
+// position once, not a backlog; a stopped engine posts nothing.
+// contains:
+//      player_cmd  -- one command for the engine
+//      dest_for()  -- the destination of a song port and channel
+//      same_routing() -- two commands send the song to the same places
+//      player_stats -- how fast the engine is sending
+//      PLAYER      -- the engine thread
+//      post()      -- queue a command, return at once
+//      inject()    -- send an event to the port as soon as possible, return at once
+//      sync()      -- wait until every command posted so far has been carried out
+//      stop()      -- post a stop or pause and wait for it
+//      finished()  -- the song has been played to the end
+//      set_lookahead() -- how far ahead of the queue's position events are sent, msec
+//      set_frame_rate() -- how often, at most, moved() is posted
+//      stats()     -- events sent, and the rates they went at
+//      position()  -- where playing had got to at the last moved()
+//      output_stats() -- what the backend has sent, how fast and how late
+//      failed()    -- SIGNAL, an ALSA call went wrong
+//      moved()     -- SIGNAL, the position has changed, or the song is finished
+
+#ifndef PLAYER_H
+#define PLAYER_H
+
+#include <QThread>
+#include <QMutex>
+#include <QWaitCondition>
+#include <QString>
+#include <alsa/asoundlib.h>
+#include <sys/time.h>
+#include <vector>
+#include <deque>
+#include "event_store.h"
+#include "smf_decoder.h"
+#include "chase.h"
+#include "tempo_map.h"
+#include "output.h"
+
+// events are queued at most this far ahead of the queue's position, msec
+#define DEFAULT_LOOKAHEAD 200
+#define MIN_LOOKAHEAD 20
+#define MAX_LOOKAHEAD 2000
+// moved() is posted at most this many times a second
+#define DEFAULT_FRAME_RATE 60
+#define MAX_FRAME_RATE 200
+// ALSA ports one engine sends a song to
+#define MAX_DESTS 8
+
+struct player_cmd {
+    enum {
+        PLAY,           // start the queue and play from tick
+        RESUME,         // continue the queue and play from tick
+        PAUSE,          // stop sending, stop the queue where it is
+        STOP,           // the same, and let go of the stream window
+        SEEK,           // move the stopped queue to tick
+        SEND,           // send ev (and sysex) straight to the port, in turn; see inject()
+        SONG,           // the song in the store has changed, compile it
+        TRANSPOSE,      // from now on, transpose by transpose
+        TEMPO,          // from now on, play at tempo_scale or tempo_override
+        QUIT
+    };
+    int op;
+    snd_seq_t *seq;
+    int queue;
+    snd_seq_addr_t dest[MAX_DESTS];     // where the song goes, dests of them
+    int dests;
+    unsigned char port_dest[SONG_PORTS];    // by song port, index into dest
+    unsigned char route[SONG_PORTS][16];    // by song port and channel, index into dest
+    unsigned int tick;
+    int transpose;              // semitones, all but the drum channel
+    int ppq;                    // of the song, for backends that keep their own time
+    double tempo_scale;         // tempo events go out at the written tempo times this
+    int tempo_override;         // usec per quarter for the whole song, 0 to follow it
+    bool streaming;             // decode the song from the file image as it plays
+    snd_seq_event_t ev;
+    std::vector<unsigned char> sysex;
+
+    // song port n goes to destination n, or to the first one if there are
+    // fewer; the GUI may route channels elsewhere after
+    player_cmd(int op_code, snd_seq_t *handle, int q, const snd_seq_addr_t *ports, int count = 1) :
+        op(op_code), seq(handle), queue(q), tick(0), transpose(0), ppq(0),
+        tempo_scale(1.0), tempo_override(0), streaming(false) {
+        memset(dest, 0, sizeof(dest));
+        dests = ports && count > 0 ? (count < MAX_DESTS ? count : MAX_DESTS) : 1;
+        for (int d = 0; ports && d < dests; ++d)
+            dest[d] = ports[d];
+        for (int p = 0; p < SONG_PORTS; ++p) {
+            port_dest[p] = p < dests ? p : 0;
+            memset(route[p], port_dest[p], sizeof(route[p]));
+        }
+        snd_seq_ev_clear(&ev);
+    }
+    // channel -1 for the events that have none, sysex
+    const snd_seq_addr_t &dest_for(unsigned int port, int channel) const {
+        unsigned char d = channel < 0 ? port_dest[port % SONG_PORTS] : route[port % SONG_PORTS][channel & 0x0f];
+        return dest[d < dests ? d : 0];
+    }
+    bool same_routing(const struct player_cmd &o) const {
+        return queue == o.queue && dests == o.dests && !memcmp(dest, o.dest, sizeof(dest)) &&
+            !memcmp(port_dest, o.port_dest, sizeof(port_dest)) && !memcmp(route, o.route, sizeof(route));
+    }
+};
+
+struct queued_tempo {
+    unsigned int tick;
+    int tempo;                          // usec per quarter, as written in the song
+};
+
+struct player_position {
+    unsigned int tick;
+    double seconds;                     // the backend's clock, see MIDI_OUTPUT::clock()
+    bool finished;                      // the song has been played to the end
+};
+
+struct player_stats {
+    unsigned long events;               // sent since the engine started
+    unsigned int per_second;            // over the last second of playing
+    unsigned int dispatch_rate;         // events per second of time spent sending them
+};
+
+class PLAYER : public QThread {
+    Q_OBJECT
+
+public:
+    PLAYER(EVENT_STORE &, SMF_DECODER &, const CHASE_TABLE &, const TEMPO_MAP &, MIDI_OUTPUT *,
+           QObject *parent = 0);
+    ~PLAYER();
+    void post(const struct player_cmd &);
+    void inject(const struct player_cmd &);
+    void sync();
+    void stop(const struct player_cmd &);
+    bool finished() const { return done; }
+    void set_lookahead(int msec);
+    void set_frame_rate(int fps);
+    void stats(struct player_stats &) const;
+    void position(struct player_position &);
+    void output_stats(struct output_stats &s) const { out->stats(s); }
+
+signals:
+    void failed(QString);
+    void moved();
+
+protected:
+    void run();
+
+private:
+    enum { IDLE, PLAYING, DRAINING };
+
+    bool take_commands();
+    void send_injected(std::vector<struct player_cmd> &);
+    void carry_out(struct player_cmd &);
+    void halt(const struct player_cmd &);
+    void output_events();
+    bool next_event(snd_seq_event_t &);
+    void make_event(const EVENT_STORE &, unsigned int, const struct player_cmd &, snd_seq_event_t &);
+    void compile(const struct player_cmd &);
+    void count_sent(unsigned int n, const struct timeval &began);
+    void chase_to(unsigned int tick);
+    bool transpose_note(snd_seq_event_t &);
+    int scaled_tempo(int written) const;
+    void start_tempo();
+    void retempo();
+    void tempo_played(unsigned int tick);
+    unsigned int horizon();
+    void publish(bool at_once);
+    void wait_for_work();
+    void check(const char *operation, int err);
+
+    EVENT_STORE &all_events;
+    SMF_DECODER &decoder;
+    const CHASE_TABLE &chase;
+    const TEMPO_MAP &tempo_map;         // the loaded song's, for the lookahead
+    MIDI_OUTPUT *out;                   // owned, see output.h
+
+    // shared with the GUI thread, under lock
+    QMutex lock;
+    QWaitCondition carried_out;
+    std::deque<struct player_cmd> commands;
+    std::vector<struct player_cmd> lane;    // injected events, in order
+    short lane_slot[16][128];           // where in lane a controller is, -1 if not there
+    unsigned long lane_posted;          // inject() calls the lane holds, merged or not
+    unsigned long posted;
+    unsigned long handled;
+    volatile int pending;               // commands are waiting, checked between batches
+    volatile int done;
+    volatile int lookahead;             // msec
+    volatile int frame;                 // msec between moved(), at least
+    struct player_position shown;       // as of the last publish()
+    bool move_posted;                   // moved() is out and the GUI hasn't read shown since
+    volatile unsigned long sent;
+    volatile unsigned int rate;
+    volatile unsigned int dispatch_rate;
+    int wake[2];                        // pipe, a byte is written to it for each command
+
+    // engine thread only
+    int state;
+    struct player_cmd now;              // what is playing, and where to
+    EVENT_STORE window;                 // part of a stream being played
+    std::vector<snd_seq_event_t> image; // all_events compiled, see compile()
+    struct player_cmd image_for;        // queue and routing the image was compiled for
+    unsigned int next;                  // next event of the song, or of the window
+    EVENT_STORE burst;                  // channel state to send before the song, see chase_to()
+    unsigned int burst_next;
+    bool chase_pending;                 // the stopped queue has been moved, chase on resume
+    unsigned char sent_pitch[16][128];  // by channel and written note: pitch+1 of its last note on, see transpose_note()
+    int tempo_in_force;                 // as written, before the first of tempos_queued
+    std::deque<struct queued_tempo> tempos_queued;  // sent, not yet played, see retempo()
+    unsigned int last_tick;
+    bool stop_sent;                     // queue stop at the end of the song is out
+    bool blocked;                       // the sequencer's pool is full
+    bool ahead;                         // the lookahead is full
+    bool started;                       // our start or continue has reached the queue
+    struct timeval published;           // when shown was last brought up to date
+    struct timeval mark;                // start of the current rate measurement
+    unsigned long sent_at_mark;
+    unsigned long busy_usec;            // spent sending since the mark
+};  // end class PLAYER
+
+#endif // PLAYER_H
@@ -0,0 +1,392 @@
+// smf_bench.cpp -- part of MIDI_PLAY
+// decoder throughput benchmark, built on libsmf.a with no Qt (see smf_bench.pro)
+// Generates a fixed corpus of synthetic Standard MIDI Files in memory, the
+// same bytes on every run, and times SMF_DECODER::decode() on each of them.
+// Every case runs in a child process of its own so the peak RSS reported is
+// that of the case alone.
+//      smf_bench [-s scale] [-n repeats] [-w dir] [file.mid ...]
+//      -s  multiply the size of every generated file, default 1
+//      -n  decodes per case, the fastest is reported, default 5
+//      -w  also write the corpus to dir, to load in MIDI_PLAY
+//      files given on the command line are benchmarked instead of the corpus
+// contains:
+//      operator new/delete -- count allocations made while decoding
+//      SMF_WRITER  -- builds an SMF image byte by byte
+//      make_dense(), make_running(), make_sysex(), make_tracks(), make_smpte(), make_riff() -- the corpus
+//      bench()     -- decode one image and print a line of results
+//      run_case()  -- bench() in a child process
+//      main()      -- options, corpus, report
+
+#include "smf_decoder.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <new>
+#include <string>
+#include <sys/resource.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+
+#define DEFAULT_REPEATS 5
+
+// allocations made through new, which is all the store's vectors use;
+// counted from every thread, the decoder runs a pool
+static volatile unsigned long alloc_count = 0;
+static volatile unsigned long alloc_bytes = 0;
+
+#if __cplusplus >= 201103L
+#define THROWS_BAD_ALLOC
+#define THROWS_NOTHING noexcept
+#else
+#define THROWS_BAD_ALLOC throw(std::bad_alloc)
+#define THROWS_NOTHING throw()
+#endif
+
+void *operator new(size_t size) THROWS_BAD_ALLOC {
+    __sync_fetch_and_add(&alloc_count, 1);
+    __sync_fetch_and_add(&alloc_bytes, size);
+    void *p = malloc(size ? size : 1);
+    if (!p)
+        throw std::bad_alloc();
+    return p;
+}
+void *operator new[](size_t size) THROWS_BAD_ALLOC { return operator new(size); }
+void operator delete(void *p) THROWS_NOTHING { free(p); }
+void operator delete[](void *p) THROWS_NOTHING { free(p); }
+#if __cpp_sized_deallocation
+void operator delete(void *p, size_t) THROWS_NOTHING { free(p); }
+void operator delete[](void *p, size_t) THROWS_NOTHING { free(p); }
+#endif
+
+// repeatable pseudo random numbers, so every run decodes the same bytes
+static unsigned int rand_state;
+static unsigned int next_rand() {
+    rand_state = rand_state * 1103515245 + 12345;
+    return (rand_state >> 16) & 0x7fff;
+}
+
+class SMF_WRITER {
+public:
+    std::string image;
+    void byte(int b) { image += static_cast<char>(b); }
+    void bytes(const char *s, int n) { image.append(s, n); }
+    void be(unsigned int v, int n) {
+        while (n--)
+            byte((v >> (8 * n)) & 0xff);
+    }
+    void var(unsigned int v) {
+        // variable length quantity, 7 bits per byte, high bit set on all but the last
+        unsigned char buf[5];
+        int n = 0;
+        do {
+            buf[n++] = v & 0x7f;
+            v >>= 7;
+        } while (v);
+        while (n > 1)
+            byte(buf[--n] | 0x80);
+        byte(buf[0]);
+    }
+    void header(int type, int tracks, int division) {
+        bytes("MThd", 4);
+        be(6, 4);
+        be(type, 2);
+        be(tracks, 2);
+        be(division, 2);
+    }
+    void begin_track() {
+        bytes("MTrk", 4);
+        track_start = image.size();
+        be(0, 4);               // length, filled in by end_track()
+    }
+    void end_track() {
+        var(0);
+        byte(0xff);
+        byte(0x2f);
+        byte(0);
+        unsigned int len = image.size() - track_start - 4;
+        for (int i = 0; i < 4; ++i)
+            image[track_start + i] = static_cast<char>((len >> (8 * (3 - i))) & 0xff);
+    }
+    void tempo(unsigned int delta, int usec) {
+        var(delta);
+        byte(0xff);
+        byte(0x51);
+        byte(3);
+        be(usec, 3);
+    }
+    void text(unsigned int delta, const char *s) {
+        var(delta);
+        byte(0xff);
+        byte(0x01);
+        var(strlen(s));
+        bytes(s, strlen(s));
+    }
+private:
+    unsigned int track_start;
+};  // end class SMF_WRITER
+
+static void note_track(SMF_WRITER &w, int channel, unsigned int notes, bool running) {
+    // notes on and off with short gaps, a controller now and then; with
+    // running the status byte is only sent when it changes, and notes are
+    // turned off by NOTEON with velocity 0 so one status covers everything
+    int status = 0;
+    for (unsigned int n = 0; n < notes; ++n) {
+        int key = 36 + next_rand() % 48;
+        int cmd = 0x90 | channel;
+        w.var(next_rand() % 4);
+        if (!running || cmd != status)
+            w.byte(cmd);
+        status = cmd;
+        w.byte(key);
+        w.byte(1 + next_rand() % 127);
+        if (!running && !(n % 64)) {
+            w.var(0);
+            w.byte(0xb0 | channel);
+            w.byte(7);
+            w.byte(next_rand() % 128);
+            status = 0xb0 | channel;
+        }
+        w.var(1 + next_rand() % 8);
+        if (running) {
+            w.byte(key);
+            w.byte(0);
+        } else {
+            w.byte(0x80 | channel);
+            w.byte(key);
+            w.byte(64);
+        }
+    }
+}   // end note_track
+
+static std::string make_dense(int scale) {
+    // type 1, 16 busy tracks with full status bytes, tempo changes on the first
+    SMF_WRITER w;
+    w.header(1, 17, 480);
+    w.begin_track();
+    for (int i = 0; i < 100 * scale; ++i)
+        w.tempo(i ? 1920 : 0, 400000 + next_rand() * 8);
+    w.end_track();
+    for (int t = 0; t < 16; ++t) {
+        w.begin_track();
+        note_track(w, t, 100000 * scale, false);
+        w.end_track();
+    }
+    return w.image;
+}   // end make_dense
+
+static std::string make_running(int scale) {
+    // type 0, one track of nothing but running status
+    SMF_WRITER w;
+    w.header(0, 1, 96);
+    w.begin_track();
+    note_track(w, 0, 1000000 * scale, true);
+    w.end_track();
+    return w.image;
+}   // end make_running
+
+static std::string make_sysex(int scale) {
+    // type 0, a few large sysex dumps, some split into F0/F7 packets
+    SMF_WRITER w;
+    w.header(0, 1, 96);
+    w.begin_track();
+    for (int i = 0; i < 64 * scale; ++i) {
+        unsigned int len = 256 * 1024;
+        bool split = i % 4 == 3;
+        w.var(10);
+        w.byte(0xf0);
+        w.var(split ? len / 2 : len);
+        for (unsigned int b = 0; b + 1 < (split ? len / 2 : len); ++b)
+            w.byte(next_rand() & 0x7f);
+        w.byte(split ? 0x00 : 0xf7);
+        if (split) {
+            w.var(1);
+            w.byte(0xf7);
+            w.var(len / 2);
+            for (unsigned int b = 0; b + 1 < len / 2; ++b)
+                w.byte(next_rand() & 0x7f);
+            w.byte(0xf7);
+        }
+        w.var(0);
+        w.byte(0x90);
+        w.byte(60);
+        w.byte(100);
+    }
+    w.end_track();
+    return w.image;
+}   // end make_sysex
+
+static std::string make_tracks(int scale) {
+    // type 1 with the most tracks the decoder takes
+    SMF_WRITER w;
+    w.header(1, 1000, 480);
+    for (int t = 0; t < 1000; ++t) {
+        w.begin_track();
+        w.text(0, "synthetic track");
+        note_track(w, t % 16, 1000 * scale, t & 1);
+        w.end_track();
+    }
+    return w.image;
+}   // end make_tracks
+
+static std::string make_smpte(int scale) {
+    // 25 fps, 40 ticks per frame; the tempo metas have to be skipped
+    SMF_WRITER w;
+    w.header(1, 8, 0xe728);
+    for (int t = 0; t < 8; ++t) {
+        w.begin_track();
+        for (int i = 0; i < 20 * scale; ++i) {
+            w.tempo(0, 500000);
+            note_track(w, t, 10000, false);
+        }
+        w.end_track();
+    }
+    return w.image;
+}   // end make_smpte
+
+static std::string make_riff(int scale) {
+    // the dense song wrapped in a RIFF RMID file, after a chunk to skip
+    std::string smf = make_dense(scale);
+    SMF_WRITER w;
+    w.bytes("RIFF", 4);
+    unsigned int riff_len = 4 + 8 + 6 + 8 + smf.size();
+    for (int i = 0; i < 4; ++i)
+        w.byte((riff_len >> (8 * i)) & 0xff);
+    w.bytes("RMIDDISP", 8);
+    w.bytes("\6\0\0\0bench!", 10);
+    w.bytes("data", 4);
+    for (int i = 0; i < 4; ++i)
+        w.byte((smf.size() >> (8 * i)) & 0xff);
+    w.image += smf;
+    if (smf.size() & 1)
+        w.byte(0);
+    return w.image;
+}   // end make_riff
+
+static double now() {
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+static int bench(const char *name, const unsigned char *data, int size, int repeats) {
+    // decode the image repeats times, report the fastest run
+    SMF_DECODER decoder;
+    double best = 0;
+    unsigned long allocs = 0, bytes = 0;
+    unsigned int events = 0;
+    for (int r = 0; r < repeats; ++r) {
+        EVENT_STORE store;
+        struct song_summary song;
+        decoder.set_image(data, size);
+        unsigned long count0 = alloc_count, bytes0 = alloc_bytes;
+        double start = now();
+        int rc = decoder.decode(store, song);
+        double t = now() - start;
+        if (rc != SMF_DECODER::SMF_OK) {
+            printf("%-12s %s\n", name, decoder.error_message());
+            return 0;
+        }
+        if (!r || t < best)
+            best = t;
+        allocs = alloc_count - count0;
+        bytes = alloc_bytes - bytes0;
+        events = store.size();
+    }
+    struct rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+    if (best <= 0)
+        best = 1e-6;
+    printf("%-12s %8.1f %10u %8.1f %9.2f %8lu %9.1f %8.1f\n", name,
+           size / 1048576.0, events, size / 1048576.0 / best, events / 1e6 / best,
+           allocs, bytes / 1048576.0, ru.ru_maxrss / 1024.0);
+    return 1;
+}   // end bench
+
+static int run_case(const char *name, std::string (*make)(int), const char *file, int scale, int repeats, const char *dir) {
+    // one case in a child process, so its peak RSS is its own
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid < 0) {
+        perror("fork");
+        return 0;
+    }
+    if (pid) {
+        int status;
+        waitpid(pid, &status, 0);
+        return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+    }
+    int ok;
+    if (make) {
+        rand_state = 1;
+        std::string image = make(scale);
+        if (dir) {
+            std::string path = std::string(dir) + "/" + name + ".mid";
+            FILE *f = fopen(path.c_str(), "wb");
+            if (!f || fwrite(image.data(), 1, image.size(), f) != image.size())
+                fprintf(stderr, "cannot write %s - %s\n", path.c_str(), strerror(errno));
+            if (f)
+                fclose(f);
+        }
+        ok = bench(name, reinterpret_cast<const unsigned char *>(image.data()), image.size(), repeats);
+    } else {
+        SMF_DECODER file_image;
+        if (!file_image.map(file)) {
+            fprintf(stderr, "cannot open %s - %s\n", file, strerror(errno));
+            _exit(1);
+        }
+        const char *base = strrchr(file, '/');
+        ok = bench(base ? base + 1 : file, file_image.data(), file_image.size(), repeats);
+    }
+    fflush(stdout);
+    _exit(ok ? 0 : 1);
+}   // end run_case
+
+int main(int argc, char *argv[]) {
+    static const struct {
+        const char *name;
+        std::string (*make)(int);
+    } corpus[] = {
+        { "dense", make_dense },
+        { "running", make_running },
+        { "sysex", make_sysex },
+        { "tracks1000", make_tracks },
+        { "smpte", make_smpte },
+        { "riff", make_riff }
+    };
+    int scale = 1, repeats = DEFAULT_REPEATS;
+    const char *dir = 0;
+    int c;
+    while ((c = getopt(argc, argv, "s:n:w:")) != -1) {
+        switch (c) {
+        case 's':
+            scale = atoi(optarg);
+            break;
+        case 'n':
+            repeats = atoi(optarg);
+            break;
+        case 'w':
+            dir = optarg;
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-s scale] [-n repeats] [-w dir] [file.mid ...]\n", argv[0]);
+            return 2;
+        }
+    }
+    if (scale < 1)
+        scale = 1;
+    if (repeats < 1)
+        repeats = 1;
+    printf("%-12s %8s %10s %8s %9s %8s %9s %8s\n", "case", "MB", "events", "MB/s", "Mevents/s", "allocs", "alloc MB", "peak MB");
+    int failed = 0;
+    if (optind < argc) {
+        for (int i = optind; i < argc; ++i)
+            failed += !run_case(0, 0, argv[i], scale, repeats, 0);
+    } else {
+        for (unsigned int i = 0; i < sizeof(corpus) / sizeof(corpus[0]); ++i)
+            failed += !run_case(corpus[i].name, corpus[i].make, 0, scale, repeats, dir);
+    }
+    return failed ? 1 : 0;
+}   // end main
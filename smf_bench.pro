@@ -0,0 +1,13 @@
+# -------------------------------------------------
+# smf_bench: decoder throughput benchmark on a
+# synthetic SMF corpus, links libsmf, no Qt
+# -------------------------------------------------
+CONFIG -= qt
+CONFIG += console
+TARGET = smf_bench
+TEMPLATE = app
+SOURCES += smf_bench.cpp
+HEADERS += smf_decoder.h \
+    event_store.h
+PRE_TARGETDEPS += libsmf.a
+LIBS += -L. -lsmf -lpthread
@@ -0,0 +1,731 @@
+// smf_decoder.cpp -- part of MIDI_PLAY
+// validate the midi file is formatted correctly, then decode the track data
+// into an EVENT_STORE and a song_summary.
+// The file is memory-mapped (or read in one go if it can't be mapped) and
+// all reads go through a bounds-checked cursor into that byte image.
+// No Qt and no global state, see smf_decoder.h
+// contains:
+//      map()       -- map the whole file into memory
+//      unmap()     -- release the file image
+//      set_image() -- use an image the caller owns
+//      decode()    -- this is the heavy lifting of parsing the Standard Midi File (SMF) data
+//      open_stream() -- set up a song to be decoded while it plays
+//      stream_rewind() -- put the stream back at the start of the song
+//      stream_fill() -- decode the next events of the stream, in song order
+//      error_message() -- text for the last error
+//      set_progress() -- progress callback for decode()
+//      report()    -- call the progress callback when the percentage moves
+//      read_header() -- MThd or RIFF header and the chunk directory
+//      read_riff() -- RIFF is a (potential) wrapper around SMF data, strip it off
+//      read_smf()  -- SMF header, tempo and the MTrk chunk directory
+//      run_jobs()  -- run every track job on the thread pool
+//      scan_track() -- called from the decode threads to count the events of a track
+//      read_track() -- called from the decode threads to get midi data, one track per call
+//      next_event() -- decode the next event of a track from its cursor
+//      decode_worker() -- thread pool body, runs scan_track or read_track on queued tracks
+//      start_cursor() -- helper function, cursor at the start of a track
+//      read_id()   -- helper function
+//      read_byte()   -- helper function
+//      skip()   -- helper function
+//      read_32_le()   -- helper function
+//      read_int()   -- helper function
+//      get_var()   -- helper function, variable length quantity from a cursor
+
+#include "smf_decoder.h"
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define MAKE_ID(c1, c2, c3, c4) ((c1) | ((c2) << 8) | ((c3) << 16) | ((c4) << 24))
+#define MAX_DECODE_THREADS 16
+// events merged between progress reports and cancel checks
+#define MERGE_STEP 0x10000
+
+// event type by command nibble
+static const unsigned char cmd_type[16] = {
+    0, 0, 0, 0, 0, 0, 0, 0,
+    SND_SEQ_EVENT_NOTEOFF, SND_SEQ_EVENT_NOTEON, SND_SEQ_EVENT_KEYPRESS, SND_SEQ_EVENT_CONTROLLER,
+    SND_SEQ_EVENT_PGMCHANGE, SND_SEQ_EVENT_CHANPRESS, SND_SEQ_EVENT_PITCHBEND, 0
+};
+static const unsigned char gm_mode_set[6] = { 0xF0, 0x7E, 0x7F, 0x09, 0x01, 0xF7 };
+
+SMF_DECODER::SMF_DECODER() :
+    file_data(0), file_size(0), file_mapped(false), file_owned(false),
+    file_offset(0), file_eof(false), smpte_timing(false),
+    err(SMF_OK), err_offset(-1), err_value(0), next_job(0), scanning(false), staging(0),
+    bytes_done(0), bytes_total(0), cancelled(0),
+    progress_fn(0), progress_arg(0), last_percent(-1)
+{
+    message[0] = 0;
+}
+
+SMF_DECODER::~SMF_DECODER() {
+    unmap();
+}
+
+// helper functions
+int SMF_DECODER::fail(int code, int value) {
+    err = code;
+    err_value = value;
+    return 0;
+}
+int SMF_DECODER::read_id() {
+    return read_32_le();
+}
+int SMF_DECODER::read_byte() {
+    if (file_offset >= file_size) {
+        file_eof = true;
+        return EOF;
+    }
+    return file_data[file_offset++];
+}
+int SMF_DECODER::read_32_le() {
+    if (file_offset + 4 > file_size) {
+        file_offset = file_size;
+        file_eof = true;
+        return -1;
+    }
+    const unsigned char *p = file_data + file_offset;
+    file_offset += 4;
+    return p[0] | (p[1] << 8) | (p[2] << 16) | (p[3] << 24);
+}
+int SMF_DECODER::read_int(int bytes) {
+    int value = 0;
+    do {
+        int c = read_byte();
+        if (c == EOF)
+            return -1;
+        value = (value << 8) | c;
+    } while (--bytes);
+    return value;
+}
+// variable length quantity from a track cursor
+static int get_var(const unsigned char *&p, const unsigned char *end) {
+    int value = 0;
+    for (int n = 0; n < 4; ++n) {
+        if (p >= end)
+            return -1;
+        int c = *p++;
+        value = (value << 7) | (c & 0x7f);
+        if (!(c & 0x80))
+            return value;
+    }
+    return -1;      // more than 4 bytes
+}   // end get_var
+void SMF_DECODER::skip(int bytes) {
+    // chunk and meta skips are just cursor moves
+    if (bytes <= 0)
+        return;
+    if (bytes > file_size - file_offset) {
+        file_offset = file_size;
+        file_eof = true;
+        return;
+    }
+    file_offset += bytes;
+}
+void SMF_DECODER::start_cursor(struct track_cursor &c, int start, int end) const {
+    c.p = file_data + start;
+    c.end = file_data + end;
+    c.tick = 0;
+    c.last_cmd = 0;
+    c.port = 0;
+    c.key_sf = -1;
+    c.key_minor = false;
+    c.gm_mode = false;
+}
+
+
+int SMF_DECODER::map(const char *file_name) {
+    // map the whole file read-only; fall back to a single read() for
+    // things that can't be mapped (pipes, some network filesystems)
+    struct stat st;
+    unmap();
+    cancelled = 0;
+    int fd = open(file_name, O_RDONLY);
+    if (fd < 0)
+        return 0;
+    if (fstat(fd, &st) < 0 || st.st_size > 0x7fffffff) {
+        close(fd);
+        errno = EFBIG;
+        return 0;
+    }
+    file_size = st.st_size;
+    if (file_size > 0) {
+        void *p = mmap(0, file_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (p != MAP_FAILED) {
+            madvise(p, file_size, MADV_SEQUENTIAL);
+            file_data = static_cast<const unsigned char *>(p);
+            file_mapped = true;
+        }
+        else {
+            unsigned char *buf = static_cast<unsigned char *>(malloc(file_size));
+            int got = 0;
+            while (buf && got < file_size) {
+                ssize_t n = read(fd, buf + got, file_size - got);
+                if (n <= 0) break;
+                got += n;
+            }
+            if (!buf || got < file_size) {
+                free(buf);
+                close(fd);
+                file_size = 0;
+                return 0;
+            }
+            file_data = buf;
+        }
+        file_owned = true;
+    }
+    close(fd);
+    return 1;
+}   // end map
+
+void SMF_DECODER::unmap() {
+    if (file_data && file_owned) {
+        if (file_mapped)
+            munmap(const_cast<unsigned char *>(file_data), file_size);
+        else
+            free(const_cast<unsigned char *>(file_data));
+    }
+    file_data = 0;
+    file_size = file_offset = 0;
+    file_mapped = file_owned = false;
+    stream_start.clear();
+    stream_tracks.clear();
+    stream_pending.clear();
+    stream_heads = merge_queue();
+}   // end unmap
+
+void SMF_DECODER::set_image(const unsigned char *data, int size) {
+    unmap();
+    cancelled = 0;
+    file_data = data;
+    file_size = size;
+}   // end set_image
+
+void SMF_DECODER::set_progress(void (*fn)(void *, int), void *arg) {
+    progress_fn = fn;
+    progress_arg = arg;
+}   // end set_progress
+
+void SMF_DECODER::report(int percent) {
+    if (progress_fn && percent != last_percent) {
+        last_percent = percent;
+        progress_fn(progress_arg, percent);
+    }
+}   // end report
+
+const char *SMF_DECODER::error_message() {
+    switch (err) {
+    case SMF_OK:
+        snprintf(message, sizeof(message), "no error");
+        break;
+    case SMF_NOT_SMF:
+        snprintf(message, sizeof(message), "not a Standard MIDI File");
+        break;
+    case SMF_INVALID_FORMAT:
+        snprintf(message, sizeof(message), "invalid file format");
+        break;
+    case SMF_NO_DATA_CHUNK:
+        snprintf(message, sizeof(message), "data chunk not found");
+        break;
+    case SMF_UNSUPPORTED_TYPE:
+        snprintf(message, sizeof(message), "type %d format is not supported", err_value);
+        break;
+    case SMF_BAD_TRACK_COUNT:
+        snprintf(message, sizeof(message), "invalid number of tracks (%d)", err_value);
+        break;
+    case SMF_BAD_SMPTE_RATE:
+        snprintf(message, sizeof(message), "invalid number of SMPTE frames per second (%d)", err_value);
+        break;
+    case SMF_TRUNCATED:
+        snprintf(message, sizeof(message), "unexpected end of file");
+        break;
+    case SMF_BAD_CHUNK_LENGTH:
+        snprintf(message, sizeof(message), "invalid chunk length %d", err_value);
+        break;
+    case SMF_BAD_DATA:
+        snprintf(message, sizeof(message), "invalid MIDI data (offset %d)", err_offset);
+        break;
+    case SMF_NO_EVENTS:
+        snprintf(message, sizeof(message), "no MIDI events found");
+        break;
+    case SMF_CANCELLED:
+        snprintf(message, sizeof(message), "cancelled");
+        break;
+    default:
+        snprintf(message, sizeof(message), "error %d", err);
+        break;
+    }
+    return message;
+}   // end error_message
+
+
+// start of data reading functions
+int SMF_DECODER::read_header(struct song_summary &song) {
+    // check the file type, then on to the SMF header
+    file_offset = 0;
+    file_eof = false;
+    err = SMF_OK;
+    err_offset = -1;
+    err_value = 0;
+    jobs.clear();
+    switch (read_id()) {
+    case MAKE_ID('M', 'T', 'h', 'd'):
+        return read_smf(song);
+    case MAKE_ID('R', 'I', 'F', 'F'):
+        return read_riff(song);
+    default:
+        return fail(SMF_NOT_SMF);
+    }
+}   // end read_header
+
+int SMF_DECODER::read_riff(struct song_summary &song) {
+    // skip file length
+    read_byte();
+    read_byte();
+    read_byte();
+    read_byte();
+    // check file type ("RMID" = RIFF MIDI)
+    if (read_id() != MAKE_ID('R', 'M', 'I', 'D'))
+        return fail(SMF_INVALID_FORMAT);
+    // search for "data" chunk
+    for (;;) {
+        int id = read_id();
+        int len = read_32_le();
+        if (file_eof || len < 0)
+            return fail(SMF_NO_DATA_CHUNK);
+        if (id == MAKE_ID('d', 'a', 't', 'a'))
+            break;
+        skip((len + 1) & ~1);
+    }
+    // the "data" chunk must contain data in SMF format
+    if (read_id() != MAKE_ID('M', 'T', 'h', 'd'))
+        return fail(SMF_INVALID_FORMAT);
+    return read_smf(song);
+}   // end read_riff
+
+int SMF_DECODER::read_smf(struct song_summary &song) {
+    // header and tempo of the song, then a directory of the MTrk chunks so
+    // the tracks can be decoded independently of each other
+    // the starting position is immediately after the "MThd" id
+    int header_len = read_int(4);   // header length
+    if (header_len < 6)
+        return fail(SMF_INVALID_FORMAT);
+    int type = read_int(2);     // midi type 0 or 1
+    if (type != 0 && type != 1)
+        return fail(SMF_UNSUPPORTED_TYPE, type);
+    int num_tracks = read_int(2);       // number of tracks
+    if (num_tracks < 1 || num_tracks > 1000)
+        return fail(SMF_BAD_TRACK_COUNT, num_tracks);
+    int time_division = read_int(2);    // time division
+    if (time_division < 0)
+        return fail(SMF_INVALID_FORMAT);
+    // interpret and set tempo
+    smpte_timing = !!(time_division & 0x8000);
+    if (!smpte_timing) {
+        // MIDI time_division is ticks per quarter
+        song.tempo = 500000;        // default of 120 bpm in case there are no tempo changes in the midi file
+        song.ppq = time_division;   // the PPQ from the midi file header
+    } else {
+	// SMPTE time parsing
+        // upper byte is negative frames per second
+        int i = 0x80 - ((time_division >> 8) & 0x7f);
+        // lower byte is ticks per frame
+        time_division &= 0xff;
+        // now pretend that we have quarter-note based timing
+        switch (i) {
+        case 24:
+            song.tempo = 500000;
+            song.ppq = 12 * time_division;
+            break;
+        case 25:
+            song.tempo = 400000;
+            song.ppq = 10 * time_division;
+            break;
+        case 29: // 30 drop-frame
+            song.tempo = 100000000;
+            song.ppq = 2997 * time_division;
+            break;
+        case 30:
+            song.tempo = 500000;
+            song.ppq = 15 * time_division;
+            break;
+        default:
+            return fail(SMF_BAD_SMPTE_RATE, i);
+        }
+    }
+    song.smpte_timing = smpte_timing;
+    skip(header_len - 6);
+    jobs.resize(num_tracks);
+    for (int j = 0; j < num_tracks; ++j) {
+        int len;
+        // verify data is valid
+        for (;;) {
+            int id = read_id();
+            len = read_int(4);      // track length
+            if (file_eof)
+                return fail(SMF_TRUNCATED);
+            if (len < 0)
+                return fail(SMF_BAD_CHUNK_LENGTH, len);
+            if (id == MAKE_ID('M', 'T', 'r', 'k'))
+                break;            // found start of a new track, loop back and process it
+            skip(len);
+        }   // end FOR (infinite)
+        jobs[j].start = file_offset;
+        jobs[j].end = len > file_size - file_offset ? file_size : file_offset + len;
+        skip(len);
+    }   // end FOR all tracks
+    return 1;
+}   // end read_smf
+
+int SMF_DECODER::decode(EVENT_STORE &events, struct song_summary &song) {
+    // read midi data into memory, parsing it into events
+    events.clear();
+    if (!read_header(song))
+        return err;
+    int num_tracks = jobs.size();
+    // the tracks are gone over twice, one track per job on as many threads as
+    // there are cores: first to count what each one holds, then to decode it
+    // into its own part of one store sized exactly for the song, so no array
+    // is ever regrown. Progress is by track bytes done over both passes,
+    // 0-80%, then 80-100% for merging
+    bytes_done = 0;
+    bytes_total = 0;
+    for (int j = 0; j < num_tracks; ++j)
+        bytes_total += 2 * (jobs[j].end - jobs[j].start);
+    caller = pthread_self();
+    last_percent = -1;
+    report(0);
+    scanning = true;
+    run_jobs();
+    // collect errors, sizes and track meta data, in file order
+    unsigned int total_events = 0;
+    unsigned int total_sysex = 0;
+    unsigned long total_sysex_bytes = 0;
+    for (int j = 0; j < num_tracks && !cancelled; ++j) {
+        if (jobs[j].error_offset >= 0) {
+            err_offset = jobs[j].error_offset;
+            fail(SMF_BAD_DATA);
+            jobs.clear();
+            return err;
+        }
+        jobs[j].first = total_events;
+        jobs[j].sysex_first = total_sysex;
+        jobs[j].arena_first = total_sysex_bytes;
+        total_events += jobs[j].counted.events;
+        total_sysex += jobs[j].counted.sysex;
+        total_sysex_bytes += jobs[j].counted.sysex_bytes;
+    }
+    if (!total_events && !cancelled) {
+        jobs.clear();
+        fail(SMF_NO_EVENTS);
+        return err;
+    }
+    EVENT_STORE tracks;
+    if (!cancelled) {
+        tracks.allocate(total_events, total_sysex, total_sysex_bytes);
+        staging = &tracks;
+        scanning = false;
+        run_jobs();
+        staging = 0;
+    }
+    if (cancelled) {
+        jobs.clear();
+        fail(SMF_CANCELLED);
+        return err;
+    }
+    song.key_sf = -1;
+    song.key_minor = 0;
+    song.gm_mode = 0;
+    for (int j = 0; j < num_tracks; ++j) {
+        if (jobs[j].key_sf >= 0) {
+            song.key_sf = jobs[j].key_sf;
+            song.key_minor = jobs[j].key_minor;
+        }
+        // check if a GM MODE SET command was issued
+        if (jobs[j].gm_mode)
+            song.gm_mode = 1;
+    }
+    // every track is already in tick order, so a k-way merge puts the song in
+    // order; equal ticks keep track order, same as a stable sort would.
+    // The merge only works out the order, the events are moved into it after
+    merge_queue heads;
+    for (int j = 0; j < num_tracks; ++j)
+        if (jobs[j].counted.events) {
+            merge_head head(tracks.tick(jobs[j].first), j);
+            head.pos = jobs[j].first;
+            heads.push(head);
+        }
+    std::vector<unsigned int> order;
+    order.reserve(total_events);
+    // the tempo table, the channels with notes and the length, which
+    // follows the tempo changes in song order, are taken along the way
+    struct tempo_chg tc;
+    double tempo = song.tempo;
+    unsigned int prev_tick = 0;
+    song.tempos.clear();
+    song.channels = 0;
+    song.length_seconds = 0;
+    while (!heads.empty()) {
+        merge_head head = heads.top();
+        heads.pop();
+        order.push_back(head.pos);
+        if (tracks.type(head.pos) == SND_SEQ_EVENT_TEMPO) {
+            tc.tick = head.tick;
+            tc.new_tempo = 60000000/tracks.tempo(head.pos);
+            song.tempos.push_back(tc);
+            song.length_seconds += tempo * (head.tick-prev_tick) / song.ppq / 1000000;
+            prev_tick = head.tick;
+            tempo = tracks.tempo(head.pos);
+        }
+        else if (tracks.type(head.pos) == SND_SEQ_EVENT_NOTEON)
+            song.channels |= 1 << tracks.channel(head.pos);
+        if (!(order.size() % MERGE_STEP)) {
+            if (cancelled)
+                break;
+            report(80 + 15.0 * order.size() / total_events);
+        }
+        if (++head.pos < jobs[head.track].first + jobs[head.track].counted.events) {
+            head.tick = tracks.tick(head.pos);
+            heads.push(head);
+        }
+    }
+    jobs.clear();
+    if (cancelled) {
+        fail(SMF_CANCELLED);
+        return err;
+    }
+    events.gather(tracks, order);
+    song.length_seconds += tempo * (events.last_tick()-prev_tick) / song.ppq / 1000000;
+    report(100);
+    return SMF_OK;   // good return, all data read ok
+}   // end decode
+
+void SMF_DECODER::run_jobs() {
+    // run every track job on the thread pool, this thread included
+    next_job = 0;
+    int num_threads = sysconf(_SC_NPROCESSORS_ONLN);
+    if (num_threads > static_cast<int>(jobs.size()))
+        num_threads = jobs.size();
+    if (num_threads > MAX_DECODE_THREADS)
+        num_threads = MAX_DECODE_THREADS;
+    std::vector<pthread_t> threads;
+    for (int t = 1; t < num_threads; ++t) {
+        pthread_t tid;
+        if (pthread_create(&tid, NULL, decode_worker, this) == 0)
+            threads.push_back(tid);
+    }
+    decode_worker(this);
+    for (unsigned int t = 0; t < threads.size(); ++t)
+        pthread_join(threads[t], NULL);
+}   // end run_jobs
+
+void *SMF_DECODER::decode_worker(void *arg) {
+    // keep taking the next unread track until there are none left
+    SMF_DECODER *decoder = static_cast<SMF_DECODER *>(arg);
+    bool reporter = pthread_equal(pthread_self(), decoder->caller);
+    int j;
+    while (!decoder->cancelled &&
+           (j = __sync_fetch_and_add(&decoder->next_job, 1)) < static_cast<int>(decoder->jobs.size())) {
+        struct track_job &job = decoder->jobs[j];
+        if (decoder->scanning)
+            decoder->scan_track(job);
+        else
+            decoder->read_track(job);
+        int done = __sync_add_and_fetch(&decoder->bytes_done, job.end - job.start);
+        if (reporter && decoder->bytes_total)
+            decoder->report(80.0 * done / decoder->bytes_total);
+    }
+    return NULL;
+}   // end decode_worker
+
+void SMF_DECODER::scan_track(struct track_job &job) const {
+// count the events and sysex bytes of one track, by decoding it into an
+// event_count: that takes running status, VLQs and skipped metas exactly
+// as the real decode will, so the counts are exact, not estimates
+    struct track_cursor c;
+    int rc;
+    job.counted = event_count();
+    start_cursor(c, job.start, job.end);
+    while ((rc = next_event(c, job.counted)) > 0)
+        if (!(job.counted.events % MERGE_STEP) && cancelled)
+            break;
+    job.error_offset = rc < 0 ? c.p - file_data : -1;
+}   // end scan_track
+
+void SMF_DECODER::read_track(struct track_job &job) const {
+// read one complete track from the file image, parse it into its part of
+// the staging store; only that part and the job are written to, so tracks
+// can be read concurrently
+    struct track_cursor c;
+    EVENT_STORE::span out(*staging, job.first, job.sysex_first, job.arena_first);
+    start_cursor(c, job.start, job.end);
+    while (next_event(c, out) > 0)
+        if (!(out.size() % MERGE_STEP) && cancelled)
+            break;      // the decode is thrown away, so leave the track as it is
+    job.key_sf = c.key_sf;
+    job.key_minor = c.key_minor;
+    job.gm_mode = c.gm_mode;
+}   // end read_track
+
+template <class STORE>
+int SMF_DECODER::next_event(struct track_cursor &c, STORE &events) const {
+// decode from the cursor up to and including the next event that goes into
+// events, which is an EVENT_STORE, a span of one or an event_count; meta
+// data along the way is kept in the cursor.
+// Returns 1 when an event was stored, 0 at the end of the track and -1 on
+// bad data, with c.p left at the bad byte.
+    const unsigned char *p = c.p;
+    const unsigned char *track_end = c.end;
+    while (p < track_end) {
+        unsigned char cmd;
+        int len, c1;
+
+        int delta_ticks = get_var(p, track_end);
+        if (delta_ticks < 0 || p >= track_end)
+            break;      // bad data, exit with rc
+        c.tick += delta_ticks;
+        c1 = *p++;
+        if (c1 & 0x80) {
+            // have command
+            cmd = c1;
+            if (cmd < 0xf0)
+                c.last_cmd = cmd;
+        } else {
+            // running status, step back so the data byte is read again
+            p--;
+            cmd = c.last_cmd;
+            if (!cmd)
+                goto _error;
+        }
+        switch(cmd >> 4) {
+	// channel msg with 2 parameter bytes
+        case 0x8: 	// NOTEOFF
+        case 0x9:	// NOTEON
+        case 0xa:	// KEYPRESS
+        case 0xb:	// CONTROLLER
+        case 0xe:	// PITCHBEND
+            if (track_end - p < 2) goto _error;
+            events.push_channel(c.tick, cmd_type[cmd >> 4], c.port, cmd & 0x0f, p[0] & 0x7f, p[1] & 0x7f);
+            c.p = p + 2;
+            return 1;
+	// channel msg with 1 parameter byte
+        case 0xc:	// PGMCHANGE
+        case 0xd:	// CHANPRESSURE
+            if (p >= track_end) goto _error;
+            events.push_channel(c.tick, cmd_type[cmd >> 4], c.port, cmd & 0x0f, *p++ & 0x7f);
+            c.p = p;
+            return 1;
+        case 0xf:	// SYSEX
+            switch (cmd) {
+            case 0xf0: // sysex
+            case 0xf7: // continued sysex, or escaped commands
+                len = get_var(p, track_end);
+                if (len < 0 || len > track_end - p) goto _error;
+		// check if a GM MODE SET command was issued
+		if (cmd == 0xf0 && len == 5 && !memcmp(p, gm_mode_set + 1, 5))
+		  c.gm_mode = true;
+                // copy the payload straight out of the file image
+                events.push_sysex(c.tick, c.port, &cmd, cmd == 0xf0 ? 1 : 0, p, len);
+                c.p = p + len;
+                return 1;
+            case 0xff: // meta event
+                if (p >= track_end) goto _error;
+                c1 = *p++;
+                len = get_var(p, track_end);
+                if (len < 0 || len > track_end - p) goto _error;
+                switch (c1) {
+                case 0x21: // port number, for the rest of the track
+                    if (len < 1) goto _error;
+                    c.port = p[0] % SONG_PORTS;
+                    p += len;
+                    break;
+                case 0x2f: // end of track
+                    c.p = p;
+                    return 0;   // this is the successful exit point, end of the track
+                case 0x51: // tempo
+                    if (len < 3) goto _error;
+                    if (!smpte_timing) {     // SMPTE timing doesn't change
+                        events.push_tempo(c.tick, c.port, (p[0] << 16) | (p[1] << 8) | p[2]);
+                        c.p = p + len;
+                        return 1;
+                    }
+                    p += len;
+                    break;
+                case 0x59:  // Key Signature
+                    if (len<2) goto _error;
+                    c.key_sf = p[0];
+                    c.key_minor = p[1];
+                    p += len;
+                    break;
+                default: // ignore all other meta events
+                    p += len;
+                    break;
+                }   // end SWITCH (meta-event byte value)
+                break;
+            default: // invalid Fx command
+                goto _error;
+            }   // end SWITCH (cmd)
+            break;
+        default: // cannot happen
+            goto _error;
+        }   // end switch
+    }   // end WHILE (rest of the track)
+_error:
+    c.p = p;
+    return -1;
+}   // end next_event
+
+int SMF_DECODER::open_stream(struct song_summary &song) {
+    // the chunk directory is all a stream needs up front; events are decoded
+    // as they are played, so nothing about the song past its header is known
+    if (!read_header(song))
+        return err;
+    stream_start.resize(jobs.size());
+    for (unsigned int j = 0; j < jobs.size(); ++j)
+        start_cursor(stream_start[j], jobs[j].start, jobs[j].end);
+    jobs.clear();
+    struct tempo_chg tc;
+    tc.tick = 0;
+    tc.new_tempo = 60000000/song.tempo;
+    song.tempos.assign(1, tc);
+    song.channels = 0xffff;
+    song.key_sf = -1;
+    song.key_minor = 0;
+    song.gm_mode = 0;
+    song.length_seconds = 0;
+    return SMF_OK;
+}   // end open_stream
+
+void SMF_DECODER::stream_rewind() {
+    // every track back to the start of its chunk, with its first event read
+    stream_tracks = stream_start;
+    stream_pending.assign(stream_tracks.size(), EVENT_STORE());
+    stream_heads = merge_queue();
+    for (unsigned int j = 0; j < stream_tracks.size(); ++j)
+        if (next_event(stream_tracks[j], stream_pending[j]) > 0)
+            stream_heads.push(merge_head(stream_pending[j].tick(0), j));
+}   // end stream_rewind
+
+unsigned int SMF_DECODER::stream_fill(EVENT_STORE &window, unsigned int max_events) {
+    // replace window with the next max_events events of the song, merged on
+    // the fly from the track cursors; a track with bad data just ends there
+    window.clear();
+    while (window.size() < max_events && !stream_heads.empty()) {
+        merge_head head = stream_heads.top();
+        stream_heads.pop();
+        EVENT_STORE &next = stream_pending[head.track];
+        window.append(next, 0);
+        next.clear();
+        if (next_event(stream_tracks[head.track], next) > 0) {
+            head.tick = next.tick(0);
+            stream_heads.push(head);
+        }
+    }
+    return window.size();
+}   // end stream_fill
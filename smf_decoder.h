@@ -0,0 +1,163 @@
+// smf_decoder.h -- part of MIDI_PLAY
+// Standard MIDI File decoder, built on its own as libsmf.a.
+// It knows nothing of Qt, widgets or the player: all of its state is in the
+// SMF_DECODER object, so files can be decoded on worker threads, several at
+// once, and the library can be linked into tools that have no GUI.
+// Problems come back as an error code plus the offset or value they refer
+// to; everything known about the song besides its events as a song_summary.
+// contains:
+//      song_summary -- per song data besides the events
+//      SMF_DECODER -- decoder for one file image
+//      map(), unmap() -- map a file into memory, or release it
+//      set_image() -- decode an image the caller owns instead
+//      decode()    -- the whole song into an EVENT_STORE, tracks decoded in parallel
+//      open_stream(), stream_rewind(), stream_fill() -- decode the song as it plays
+//      set_progress(), cancel() -- follow or stop a decode from another thread
+//      error(), error_offset(), error_value(), error_message() -- why decoding failed
+
+#ifndef SMF_DECODER_H
+#define SMF_DECODER_H
+
+#include "event_store.h"
+#include <vector>
+#include <queue>
+#include <pthread.h>
+
+struct song_summary {
+    double length_seconds;
+    int ppq;
+    int tempo;                  // initial queue tempo, usec per quarter
+    int smpte_timing;
+    unsigned int channels;      // bit n set if channel n plays notes
+    int key_sf;                 // key signature, -1 if the song has none
+    int key_minor;
+    int gm_mode;                // song sends GM MODE SET
+    std::vector<struct tempo_chg> tempos;
+};
+
+class SMF_DECODER {
+public:
+    enum {
+        SMF_OK = 0,
+        SMF_NOT_SMF,                    // neither MThd nor RIFF
+        SMF_INVALID_FORMAT,
+        SMF_NO_DATA_CHUNK,              // RIFF file without a "data" chunk
+        SMF_UNSUPPORTED_TYPE,           // value is the SMF type
+        SMF_BAD_TRACK_COUNT,            // value is the number of tracks
+        SMF_BAD_SMPTE_RATE,             // value is the frames per second
+        SMF_TRUNCATED,                  // file ends inside the chunk directory
+        SMF_BAD_CHUNK_LENGTH,           // value is the chunk length
+        SMF_BAD_DATA,                   // offset is the first bad byte
+        SMF_NO_EVENTS,
+        SMF_CANCELLED                   // cancel() was called
+    };
+
+    SMF_DECODER();
+    ~SMF_DECODER();
+    int map(const char *file_name);     // 0 with errno set on failure
+    void unmap();
+    void set_image(const unsigned char *data, int size);
+    const unsigned char *data() const { return file_data; }
+    int size() const { return file_size; }
+
+    int decode(EVENT_STORE &events, struct song_summary &song);
+    int open_stream(struct song_summary &song);
+    void stream_rewind();
+    unsigned int stream_fill(EVENT_STORE &window, unsigned int max_events);
+    // fn is called on the decoding thread with 0..100 as decode() gets along
+    void set_progress(void (*fn)(void *arg, int percent), void *arg);
+    void cancel() { cancelled = 1; }   // safe from any thread, until the next map()
+
+    int error() const { return err; }
+    int error_offset() const { return err_offset; }
+    int error_value() const { return err_value; }
+    const char *error_message();
+
+private:
+    // decode position inside one MTrk chunk
+    struct track_cursor {
+        const unsigned char *p;         // next byte to decode
+        const unsigned char *end;       // end of the chunk
+        unsigned int tick;              // tick of the last decoded event
+        unsigned char last_cmd;         // running status
+        unsigned char port;             // from the track's 0x21 meta, 0 until one comes
+        int key_sf;                     // last key signature seen, -1 if none
+        bool key_minor;
+        bool gm_mode;                   // track sends GM MODE SET
+    };
+    struct track_job {
+        int start;                      // first event byte of the MTrk chunk in the file image
+        int end;                        // offset just past the chunk
+        int error_offset;               // offset of bad data, -1 if the track read ok
+        int key_sf;                     // last key signature in the track, -1 if none
+        bool key_minor;
+        bool gm_mode;                   // track sends GM MODE SET
+        event_count counted;            // what the track holds, from scan_track()
+        unsigned int first;             // where the track goes in the staging store
+        unsigned int sysex_first;
+        unsigned long arena_first;
+    };
+    // head of one track in the k-way merge, ordered by tick then track number
+    struct merge_head {
+        unsigned int tick;
+        int track;
+        unsigned int pos;
+        merge_head(unsigned int t, int trk) : tick(t), track(trk), pos(0) {}
+    };
+    struct merge_later {
+        bool operator()(const merge_head &a, const merge_head &b) const {
+            return a.tick != b.tick ? a.tick > b.tick : a.track > b.track;
+        }
+    };
+    typedef std::priority_queue<merge_head, std::vector<merge_head>, merge_later> merge_queue;
+
+    SMF_DECODER(const SMF_DECODER &);               // not copyable, owns the mapping
+    SMF_DECODER &operator=(const SMF_DECODER &);
+
+    int fail(int code, int value = 0);
+    int read_id();
+    int read_byte();
+    int read_32_le();
+    int read_int(int bytes);
+    void skip(int bytes);
+    int read_header(struct song_summary &song);
+    int read_riff(struct song_summary &song);
+    int read_smf(struct song_summary &song);
+    void start_cursor(struct track_cursor &c, int start, int end) const;
+    template <class STORE>
+    int next_event(struct track_cursor &c, STORE &events) const;
+    void run_jobs();
+    void scan_track(struct track_job &job) const;
+    void read_track(struct track_job &job) const;
+    static void *decode_worker(void *arg);
+    void report(int percent);
+
+    const unsigned char *file_data;     // image of the whole file
+    int file_size;
+    bool file_mapped;                   // file_data came from mmap()
+    bool file_owned;                    // file_data is ours to release
+    int file_offset;                    // header cursor
+    bool file_eof;                      // set when a read runs off the end of file_data
+    bool smpte_timing;
+    int err;
+    int err_offset;
+    int err_value;
+    char message[64];
+    int next_job;                       // next track for the decode threads to take
+    bool scanning;                      // the decode threads count tracks, not read them
+    EVENT_STORE *staging;               // every track, each in its own part, while decoding
+    int bytes_done;                     // track bytes decoded so far, for progress
+    int bytes_total;
+    volatile int cancelled;
+    pthread_t caller;                   // thread that called decode(), the one that reports
+    void (*progress_fn)(void *, int);
+    void *progress_arg;
+    int last_percent;
+    std::vector<struct track_job> jobs;
+    std::vector<struct track_cursor> stream_start;     // each track at the start of its chunk
+    std::vector<struct track_cursor> stream_tracks;    // each track where the stream has got to
+    std::vector<EVENT_STORE> stream_pending;           // next event of each track
+    merge_queue stream_heads;
+};  // end class SMF_DECODER
+
+#endif // SMF_DECODER_H
@@ -0,0 +1,256 @@
+// song_cache.cpp -- part of MIDI_PLAY
+// keep parsed songs on disk so reopening a file costs a mapping instead of a parse
+// A current entry is not copied: the store reads its arrays from the mapping,
+// which it keeps until the next song. Entries are only ever replaced by a
+// rename, so a mapping in use always sees the file it mapped.
+// Cache files live in $XDG_CACHE_HOME/midi_play (or ~/.cache/midi_play), one per
+// song, named after a hash of the path. Layout, all native byte order:
+//      cache_header
+//      path, padded to 8 bytes
+//      ticks[events], data[events]     -- 32 bit
+//      sysex refs[sysex_count], tempos[tempo_count]    -- 2 x 32 bit
+//      types[events], ports[events], sysex arena       -- bytes
+// contains:
+//      load()      -- fill a store and summary from the cache, if the entry is current
+//      save()      -- write a store and summary to the cache
+//      content_hash() -- FNV-1a hash of some bytes
+//      sample_hash() -- hash of the song file's head, tail and blocks between
+//      cache_name() -- path of the cache file for a song
+
+#include "song_cache.h"
+#include <string>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define CACHE_MAGIC "MPCACHE1"
+#define CACHE_VERSION 3
+// what sample_hash() reads of a song file
+#define SAMPLE_ENDS 4096
+#define SAMPLE_BLOCKS 16
+#define SAMPLE_BLOCK 256
+
+unsigned int SONG_CACHE::hits=0;
+unsigned int SONG_CACHE::misses=0;
+
+struct cache_header {
+    char magic[8];
+    unsigned int version;
+    unsigned int header_size;           // catches layout changes between builds
+    unsigned long long file_size;
+    long long file_mtime;
+    unsigned long long content_hash;    // sample_hash() of the song file
+    unsigned int path_length;
+    unsigned int events;
+    unsigned int sysex_count;
+    unsigned int tempo_count;
+    unsigned long long sysex_bytes;
+    double length_seconds;
+    int ppq;
+    int tempo;
+    int smpte_timing;
+    unsigned int channels;
+    int key_sf;
+    int key_minor;
+    int gm_mode;
+    int unused;
+};
+
+static unsigned long long content_hash(const unsigned char *p, unsigned long n,
+                                       unsigned long long h = 14695981039346656037ULL) {
+    while (n--) {
+        h ^= *p++;
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+static unsigned long long sample_hash(const unsigned char *p, unsigned long n) {
+    // size and mtime are checked already; this catches a file rewritten in
+    // place within the same second, for the cost of a few pages, not the file
+    if (n <= 2 * SAMPLE_ENDS + SAMPLE_BLOCKS * SAMPLE_BLOCK)
+        return content_hash(p, n);
+    unsigned long long h = content_hash(p, SAMPLE_ENDS);
+    unsigned long step = (n - 2 * SAMPLE_ENDS) / SAMPLE_BLOCKS;
+    for (int k = 0; k < SAMPLE_BLOCKS; ++k)
+        h = content_hash(p + SAMPLE_ENDS + k * step, SAMPLE_BLOCK, h);
+    return content_hash(p + n - SAMPLE_ENDS, SAMPLE_ENDS, h);
+}
+
+static std::string cache_name(const char *path, bool create_dir) {
+    std::string dir;
+    const char *env = getenv("XDG_CACHE_HOME");
+    if (env && *env)
+        dir = env;
+    else if ((env = getenv("HOME")) && *env)
+        dir = std::string(env) + "/.cache";
+    else
+        return std::string();
+    if (create_dir)
+        mkdir(dir.c_str(), 0755);
+    dir += "/midi_play";
+    if (create_dir)
+        mkdir(dir.c_str(), 0755);
+    char name[24];
+    snprintf(name, sizeof(name), "/%016llx", content_hash(reinterpret_cast<const unsigned char *>(path), strlen(path)));
+    return dir + name + ".mpc";
+}
+
+static unsigned long padded(unsigned long n) {
+    return (n + 7) & ~7UL;
+}
+
+int SONG_CACHE::load(const char *path, const unsigned char *file_data, int file_size,
+                     EVENT_STORE &events, struct song_summary &song) {
+    struct stat st, cst;
+    std::string name = cache_name(path, false);
+    if (name.empty() || stat(path, &st) < 0) {
+        ++misses;
+        return 0;
+    }
+    int fd = open(name.c_str(), O_RDONLY);
+    if (fd < 0) {
+        ++misses;
+        return 0;
+    }
+    if (fstat(fd, &cst) < 0 || cst.st_size < static_cast<off_t>(sizeof(struct cache_header))) {
+        close(fd);
+        ++misses;
+        return 0;
+    }
+    void *map = mmap(0, cst.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        ++misses;
+        return 0;
+    }
+    const unsigned char *base = static_cast<const unsigned char *>(map);
+    const struct cache_header *h = static_cast<const struct cache_header *>(map);
+    unsigned long path_at = sizeof(struct cache_header);
+    unsigned long words_at = path_at + padded(h->path_length);
+    unsigned long bytes_at = words_at + (2UL * h->events + 2UL * h->sysex_count + 2UL * h->tempo_count) * 4;
+    unsigned long total = bytes_at + 2UL * h->events + h->sysex_bytes;
+    // cheap checks first, the sampled hash only when everything else matches
+    if (memcmp(h->magic, CACHE_MAGIC, 8) || h->version != CACHE_VERSION ||
+        h->header_size != sizeof(struct cache_header) ||
+        h->file_size != static_cast<unsigned long long>(st.st_size) ||
+        h->file_size != static_cast<unsigned long long>(file_size) ||
+        h->file_mtime != static_cast<long long>(st.st_mtime) ||
+        h->path_length != strlen(path) ||
+        total != static_cast<unsigned long>(cst.st_size) ||
+        memcmp(base + path_at, path, h->path_length) ||
+        h->content_hash != sample_hash(file_data, file_size)) {
+        munmap(map, cst.st_size);
+        ++misses;
+        return 0;
+    }
+    // the store reads each array where it is in the file, and unmaps it
+    // when it is cleared; only the small tempo table is copied
+    const unsigned int *words = reinterpret_cast<const unsigned int *>(base + words_at);
+    events.clear();
+    events.map = map;
+    events.map_bytes = cst.st_size;
+    events.rd.n = h->events;
+    events.rd.ticks = words;
+    words += h->events;
+    events.rd.data = words;
+    words += h->events;
+    events.rd.sysex_n = h->sysex_count;
+    events.rd.sysex = reinterpret_cast<const EVENT_STORE::sysex_ref *>(words);
+    words += 2 * h->sysex_count;
+    const struct tempo_chg *tempos = reinterpret_cast<const struct tempo_chg *>(words);
+    song.tempos.assign(tempos, tempos + h->tempo_count);
+    const unsigned char *bytes = base + bytes_at;
+    events.rd.types = bytes;
+    bytes += h->events;
+    events.rd.ports = bytes;
+    bytes += h->events;
+    events.rd.arena_n = h->sysex_bytes;
+    events.rd.arena = bytes;
+    song.length_seconds = h->length_seconds;
+    song.ppq = h->ppq;
+    song.tempo = h->tempo;
+    song.smpte_timing = h->smpte_timing;
+    song.channels = h->channels;
+    song.key_sf = h->key_sf;
+    song.key_minor = h->key_minor;
+    song.gm_mode = h->gm_mode;
+    ++hits;
+    return 1;
+}   // end load
+
+static int write_all(int fd, const void *data, unsigned long n) {
+    const char *p = static_cast<const char *>(data);
+    while (n) {
+        ssize_t done = write(fd, p, n);
+        if (done < 0 && errno == EINTR)
+            continue;
+        if (done <= 0)
+            return 0;
+        p += done;
+        n -= done;
+    }
+    return 1;
+}
+
+int SONG_CACHE::save(const char *path, const unsigned char *file_data, int file_size,
+                     const EVENT_STORE &events, const struct song_summary &song) {
+    struct stat st;
+    std::string name = cache_name(path, true);
+    if (name.empty() || stat(path, &st) < 0)
+        return 0;
+    struct cache_header h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, CACHE_MAGIC, 8);
+    h.version = CACHE_VERSION;
+    h.header_size = sizeof(h);
+    h.file_size = file_size;
+    h.file_mtime = st.st_mtime;
+    h.content_hash = sample_hash(file_data, file_size);
+    h.path_length = strlen(path);
+    h.events = events.size();
+    h.sysex_count = events.sysex_count();
+    h.tempo_count = song.tempos.size();
+    h.sysex_bytes = events.sysex_bytes();
+    h.length_seconds = song.length_seconds;
+    h.ppq = song.ppq;
+    h.tempo = song.tempo;
+    h.smpte_timing = song.smpte_timing;
+    h.channels = song.channels;
+    h.key_sf = song.key_sf;
+    h.key_minor = song.key_minor;
+    h.gm_mode = song.gm_mode;
+    // write a temp file and rename it, so readers never see half an entry
+    std::string tmp = name + ".tmp";
+    int fd = open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+        return 0;
+    static const char zeros[8] = { 0 };
+    int ok = write_all(fd, &h, sizeof(h)) &&
+             write_all(fd, path, h.path_length) &&
+             write_all(fd, zeros, padded(h.path_length) - h.path_length);
+    if (ok && h.events)
+        ok = write_all(fd, events.rd.ticks, h.events * 4UL) &&
+             write_all(fd, events.rd.data, h.events * 4UL);
+    if (ok && h.sysex_count)
+        ok = write_all(fd, events.rd.sysex, h.sysex_count * sizeof(EVENT_STORE::sysex_ref));
+    if (ok && h.tempo_count)
+        ok = write_all(fd, &song.tempos[0], h.tempo_count * sizeof(struct tempo_chg));
+    if (ok && h.events)
+        ok = write_all(fd, events.rd.types, h.events) &&
+             write_all(fd, events.rd.ports, h.events);
+    if (ok && h.sysex_bytes)
+        ok = write_all(fd, events.rd.arena, h.sysex_bytes);
+    if (close(fd) < 0)
+        ok = 0;
+    if (!ok || rename(tmp.c_str(), name.c_str()) < 0) {
+        unlink(tmp.c_str());
+        return 0;
+    }
+    return 1;
+}   // end save
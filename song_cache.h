@@ -0,0 +1,28 @@
+// song_cache.h -- part of MIDI_PLAY
+// on-disk cache of already parsed songs, so reopening a file skips the parse.
+// A cache file holds the sorted EVENT_STORE arrays, the tempo table and the
+// song summary in native layout; it is mapped, and the store reads the
+// arrays from the mapping. Entries are keyed by path, size, mtime and a
+// hash of the song file's head, tail and a few blocks between.
+// contains:
+//      SONG_CACHE::load() -- fill a store and summary from the cache, if current
+//      SONG_CACHE::save() -- write a store and summary to the cache
+//      SONG_CACHE::hits, SONG_CACHE::misses -- lookup counters
+
+#ifndef SONG_CACHE_H
+#define SONG_CACHE_H
+
+#include "event_store.h"
+#include "smf_decoder.h"
+
+class SONG_CACHE {
+public:
+    static int load(const char *path, const unsigned char *file_data, int file_size,
+                    EVENT_STORE &events, struct song_summary &song);
+    static int save(const char *path, const unsigned char *file_data, int file_size,
+                    const EVENT_STORE &events, const struct song_summary &song);
+    static unsigned int hits;
+    static unsigned int misses;
+};  // end class SONG_CACHE
+
+#endif // SONG_CACHE_H
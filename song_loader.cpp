@@ -0,0 +1,109 @@
+// song_loader.cpp -- part of MIDI_PLAY
+// load a song off the GUI thread: map the file, then take the song from the
+// song cache, decode it, or set it up as a stream if it is too big to load.
+// The tempo table and channel usage come out of the same decode pass, the
+// tick index, the chase snapshots and the tempo map are built here once the
+// song is in, and then it is playable; the song cache file and the meter
+// timeline follow, while it may be playing.
+// contains:
+//      SONG_LOADER -- constructor
+//      ~SONG_LOADER -- destructor
+//      load()      -- start the thread on a file
+//      cancel()    -- stop the load
+//      run()       -- thread body
+//      report()    -- decoder progress callback, emits progress()
+
+#include "song_loader.h"
+#include "song_cache.h"
+#include <string.h>
+#include <errno.h>
+
+// files this big are played as a stream instead of being loaded whole
+#define STREAM_FILE_SIZE (64 << 20)
+// quarter notes per entry of the song's tick index, a bar of 4/4
+#define INDEX_QUARTERS 4
+
+SONG_LOADER::SONG_LOADER(SMF_DECODER &dec, EVENT_STORE &store, CHASE_TABLE &snapshots,
+                         TEMPO_MAP &map, METER_TIMELINE &timeline, struct song_summary &summary,
+                         QObject *parent) :
+    QThread(parent),
+    decoder(dec),
+    events(store),
+    chase(snapshots),
+    tempo_map(map),
+    meters(timeline),
+    song(summary),
+    cancelled(0),
+    rc(SMF_DECODER::SMF_OK),
+    open_err(0),
+    stream(false)
+{
+    file_name[0] = 0;
+    decoder.set_progress(report, this);
+}
+
+SONG_LOADER::~SONG_LOADER() {
+    wait();
+    decoder.set_progress(0, 0);
+}
+
+void SONG_LOADER::load(const char *name) {
+    strncpy(file_name, name, sizeof(file_name) - 1);
+    file_name[sizeof(file_name) - 1] = 0;
+    cancelled = 0;
+    start();
+}   // end load
+
+void SONG_LOADER::cancel() {
+    // the flag covers the time before the decoder has the file mapped
+    cancelled = 1;
+    decoder.cancel();
+}   // end cancel
+
+void SONG_LOADER::run() {
+    open_err = 0;
+    if (!decoder.map(file_name)) {
+        open_err = errno;
+        rc = -1;
+        return;
+    }
+    if (cancelled) {
+        rc = SMF_DECODER::SMF_CANCELLED;
+        return;
+    }
+    // a very big file is played as it decodes, without going through the cache
+    stream = decoder.size() >= STREAM_FILE_SIZE;
+    // a song parsed before is taken straight from the cache
+    bool cached = false;
+    if (stream)
+        rc = decoder.open_stream(song);
+    else if (SONG_CACHE::load(file_name, decoder.data(), decoder.size(), events, song)) {
+        rc = SMF_DECODER::SMF_OK;
+        cached = true;
+    }
+    else    // validate and load the midi data into memory for playing
+        rc = decoder.decode(events, song);
+    if (rc != SMF_DECODER::SMF_OK)
+        return;
+    // seeking, resuming and the display find their place through the index,
+    // and the engine starts part way through from the chase snapshots; time
+    // is turned into ticks and back through the tempo map. A stream's table
+    // and map have none, just the tempo the song starts at
+    if (!stream)
+        events.index_ticks(song.ppq * INDEX_QUARTERS);
+    chase.build(events, song.tempo);
+    tempo_map.build(events, song.tempo, song.ppq);
+    emit playable();
+    // the rest only reads the song, which may be playing by now: the cache
+    // file for next time, and the meter timeline, laid out by the tempo map.
+    // A stream has no meters
+    if (!stream && !cached && !cancelled)
+        SONG_CACHE::save(file_name, decoder.data(), decoder.size(), events, song);
+    if (!cancelled)
+        meters.build(events, tempo_map);
+}   // end run
+
+void SONG_LOADER::report(void *arg, int percent) {
+    // runs on the loader thread, the connection queues it to the GUI
+    emit static_cast<SONG_LOADER *>(arg)->progress(percent);
+}   // end report
@@ -0,0 +1,63 @@
+// song_loader.h -- part of MIDI_PLAY
+// loads a song on a thread of its own, so the window stays live while a big
+// file is decoded. The loader fills the store, chase table, tempo map,
+// meter timeline, summary and decoder it is given. Once playable() is
+// emitted it only reads the store, summary and decoder, and the song can be
+// played while it builds the meter timeline and writes the song cache; the
+// owner must leave the timeline alone, and the decoder mapped, until
+// finished() is emitted.
+// contains:
+//      SONG_LOADER -- the loader thread
+//      load()      -- start loading a file
+//      cancel()    -- stop loading, finished() follows with SMF_CANCELLED
+//      result(), open_errno(), streaming() -- how the load went
+//      progress()  -- SIGNAL, 0..100 as the decode gets along
+//      playable()  -- SIGNAL, the song is in and can be played
+
+#ifndef SONG_LOADER_H
+#define SONG_LOADER_H
+
+#include <QThread>
+#include <limits.h>
+#include "smf_decoder.h"
+#include "chase.h"
+#include "tempo_map.h"
+#include "meters.h"
+
+class SONG_LOADER : public QThread {
+    Q_OBJECT
+
+public:
+    SONG_LOADER(SMF_DECODER &, EVENT_STORE &, CHASE_TABLE &, TEMPO_MAP &, METER_TIMELINE &,
+                struct song_summary &, QObject *parent = 0);
+    ~SONG_LOADER();
+    void load(const char *file_name);
+    void cancel();
+    int result() const { return rc; }           // SMF_DECODER code, -1 if the file would not open
+    int open_errno() const { return open_err; }
+    bool streaming() const { return stream; }
+
+signals:
+    void progress(int);
+    void playable();
+
+protected:
+    void run();
+
+private:
+    static void report(void *, int);
+
+    SMF_DECODER &decoder;
+    EVENT_STORE &events;
+    CHASE_TABLE &chase;
+    TEMPO_MAP &tempo_map;
+    METER_TIMELINE &meters;
+    struct song_summary &song;
+    char file_name[PATH_MAX];
+    volatile int cancelled;
+    int rc;
+    int open_err;
+    bool stream;
+};  // end class SONG_LOADER
+
+#endif // SONG_LOADER_H
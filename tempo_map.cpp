@@ -0,0 +1,82 @@
+// tempo_map.cpp -- part of MIDI_PLAY, built into libsmf.a
+// a song's tempo map, see tempo_map.h. No Qt, no ALSA calls.
+// contains:
+//      clear()     -- one piece at one tempo
+//      build()     -- one pass over the song's events for the tempo changes
+//      piece_at()  -- the piece a tick is in, by binary search
+//      usec_at()   -- tick to time
+//      tick_at()   -- time to tick, by binary search on the pieces' times
+//      tempo_at()  -- the tempo at a tick, from a cursor
+
+#include "tempo_map.h"
+#include <algorithm>
+
+static bool piece_before(unsigned int tick, const struct tempo_piece &p) {
+    return tick < p.tick;
+}
+
+static bool time_before(double usec, const struct tempo_piece &p) {
+    return usec < p.usec;
+}
+
+void TEMPO_MAP::clear(int song_tempo, int ppq) {
+    struct tempo_piece first = { 0, song_tempo > 0 ? song_tempo : 500000, 0 };
+    std::vector<struct tempo_piece>(1, first).swap(pieces);
+    ticks_per_quarter = ppq > 0 ? ppq : 96;
+}   // end clear
+
+void TEMPO_MAP::build(const EVENT_STORE &events, int song_tempo, int ppq) {
+    // a piece for each tempo event, in song order; several at one tick
+    // leave the last of them, as that is the one that plays
+    clear(song_tempo, ppq);
+    for (unsigned int i = 0; i < events.size(); ++i) {
+        if (events.type(i) != SND_SEQ_EVENT_TEMPO || events.tempo(i) <= 0)
+            continue;
+        struct tempo_piece &last = pieces.back();
+        if (events.tick(i) == last.tick) {
+            last.tempo = events.tempo(i);
+            continue;
+        }
+        struct tempo_piece p;
+        p.tick = events.tick(i);
+        p.tempo = events.tempo(i);
+        p.usec = last.usec + static_cast<double>(p.tick - last.tick) * last.tempo / ticks_per_quarter;
+        pieces.push_back(p);
+    }
+}   // end build
+
+unsigned int TEMPO_MAP::piece_at(unsigned int tick) const {
+    // the last piece that starts at or before tick; the first starts at 0
+    return std::upper_bound(pieces.begin(), pieces.end(), tick, piece_before) - pieces.begin() - 1;
+}   // end piece_at
+
+double TEMPO_MAP::usec_at(unsigned int tick) const {
+    const struct tempo_piece &p = pieces[piece_at(tick)];
+    return p.usec + static_cast<double>(tick - p.tick) * p.tempo / ticks_per_quarter;
+}   // end usec_at
+
+unsigned int TEMPO_MAP::tick_at(double usec) const {
+    // the last tick that has started by usec, so that tick_at(usec_at(t)) is t
+    if (usec <= 0)
+        return 0;
+    unsigned int k = std::upper_bound(pieces.begin(), pieces.end(), usec, time_before) - pieces.begin() - 1;
+    const struct tempo_piece &p = pieces[k];
+    double ticks = (usec - p.usec) * ticks_per_quarter / p.tempo;
+    return p.tick + static_cast<unsigned int>(ticks + 1e-6);
+}   // end tick_at
+
+int TEMPO_MAP::tempo_at(unsigned int tick, unsigned int &cursor) const {
+    // the cursor's piece or the next one is the answer all the time a song
+    // plays on; anything else, a seek or another song, searches again
+    unsigned int k = cursor;
+    if (k < pieces.size() && pieces[k].tick <= tick) {
+        if (k + 1 == pieces.size() || tick < pieces[k + 1].tick)
+            return pieces[k].tempo;
+        if (k + 2 == pieces.size() || tick < pieces[k + 2].tick) {
+            cursor = k + 1;
+            return pieces[k + 1].tempo;
+        }
+    }
+    cursor = piece_at(tick);
+    return pieces[cursor].tempo;
+}   // end tempo_at
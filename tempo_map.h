@@ -0,0 +1,49 @@
+// tempo_map.h -- part of MIDI_PLAY, built into libsmf.a
+// where a song's ticks fall in time: the song cut into pieces of one tempo
+// each, with the time every piece starts at worked out once when the song
+// is loaded. A tick or a time is then found by a binary search over the
+// pieces and one multiplication in the piece, however many tempo changes
+// the song has, and the result is exact, not a proportion of the length.
+// Times are microseconds of the song as written, from its first tick.
+// contains:
+//      tempo_piece -- one stretch of the song at one tempo
+//      TEMPO_MAP   -- the pieces of one song
+//      build()     -- take the pieces from a song's tempo events
+//      usec_at()   -- the time of a tick
+//      tick_at()   -- the tick at a time
+//      tempo_at()  -- the tempo in force at a tick, or near the last one asked
+
+#ifndef TEMPO_MAP_H
+#define TEMPO_MAP_H
+
+#include "event_store.h"
+#include <vector>
+
+struct tempo_piece {
+    unsigned int tick;                  // the piece starts here
+    int tempo;                          // usec per quarter
+    double usec;                        // time of tick
+};
+
+class TEMPO_MAP {
+public:
+    TEMPO_MAP() { clear(); }
+    void clear(int song_tempo = 500000, int ppq = 96);
+    void build(const EVENT_STORE &events, int song_tempo, int ppq);
+    double usec_at(unsigned int tick) const;
+    unsigned int tick_at(double usec) const;
+    int tempo_at(unsigned int tick) const { return pieces[piece_at(tick)].tempo; }
+    // the same for a caller that asks again and again a little further on,
+    // as the display does while the song plays: cursor is the caller's, it
+    // is left at the piece found and looked at first the next time
+    int tempo_at(unsigned int tick, unsigned int &cursor) const;
+    unsigned int size() const { return pieces.size(); }
+
+private:
+    unsigned int piece_at(unsigned int tick) const;
+
+    std::vector<struct tempo_piece> pieces;    // by tick, the first one at 0
+    int ticks_per_quarter;
+};  // end class TEMPO_MAP
+
+#endif // TEMPO_MAP_H